@@ -0,0 +1,245 @@
+#include "atlas.h"
+
+#include <climits>
+
+// -------- Skyline packer --------
+
+void SkylinePacker::reset(int w, int h)
+{
+   width = w;
+   height = h;
+   skyline.assign(1, {0, 0, w});
+}
+
+// Height the rectangle would sit at if placed at skyline[index], or -1 if it doesn't fit
+int SkylinePacker::fit(size_t index, int w, int h) const
+{
+   int x = skyline[index].x;
+   if (x + w > width)
+      return -1;
+
+   int y = 0;
+   int remaining = w;
+   for (size_t i = index; remaining > 0; i++)
+   {
+      if (i >= skyline.size())
+         return -1;
+      y = skyline[i].y > y ? skyline[i].y : y;
+      if (y + h > height)
+         return -1;
+      remaining -= skyline[i].width;
+   }
+   return y;
+}
+
+bool SkylinePacker::pack(int w, int h, int &x, int &y)
+{
+   // bottom-left: lowest resulting top edge, then narrowest segment
+   int bestY = INT_MAX, bestWidth = INT_MAX;
+   size_t best = skyline.size();
+   for (size_t i = 0; i < skyline.size(); i++)
+   {
+      int top = fit(i, w, h);
+      if (top < 0)
+         continue;
+      if (top + h < bestY || (top + h == bestY && skyline[i].width < bestWidth))
+      {
+         bestY = top + h;
+         bestWidth = skyline[i].width;
+         best = i;
+      }
+   }
+   if (best == skyline.size())
+      return false;
+
+   x = skyline[best].x;
+   y = bestY - h;
+
+   // raise the skyline under the new rectangle and trim what it covers
+   skyline.insert(skyline.begin() + best, {x, bestY, w});
+   for (size_t i = best + 1; i < skyline.size();)
+   {
+      Node &node = skyline[i];
+      int covered = x + w - node.x;
+      if (covered <= 0)
+         break;
+      if (covered >= node.width)
+      {
+         skyline.erase(skyline.begin() + i);
+         continue;
+      }
+      node.x += covered;
+      node.width -= covered;
+      break;
+   }
+
+   // merge neighbours at the same height
+   for (size_t i = 0; i + 1 < skyline.size();)
+   {
+      if (skyline[i].y == skyline[i + 1].y)
+      {
+         skyline[i].width += skyline[i + 1].width;
+         skyline.erase(skyline.begin() + i + 1);
+      }
+      else
+         i++;
+   }
+   return true;
+}
+
+// -------- Texture atlas --------
+
+TextureAtlas::TextureAtlas(int pageSize, GLenum internalFormat, GLenum format)
+    : size(pageSize), internalFormat(internalFormat), pixelFormat(format)
+{
+}
+
+TextureAtlas::~TextureAtlas()
+{
+   release();
+}
+
+void TextureAtlas::release()
+{
+   for (Page &page : pages)
+      if (page.texture)
+         glDeleteTextures(1, &page.texture);
+   pages.clear();
+   if (copyFramebuffers[0])
+      glDeleteFramebuffers(2, copyFramebuffers);
+   copyFramebuffers[0] = copyFramebuffers[1] = 0;
+}
+
+int TextureAtlas::livePages() const
+{
+   int live = 0;
+   for (const Page &page : pages)
+      live += page.texture != 0;
+   return live;
+}
+
+// cleared so that gutters filter to transparent; contents arrive through sub-image uploads
+void TextureAtlas::zeroTexture(GLuint texture) const
+{
+   std::vector<unsigned char> zeros(pageBytes(), 0);
+   glBindTexture(GL_TEXTURE_2D, texture);
+   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+   glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size, size, 0, pixelFormat, GL_UNSIGNED_BYTE, zeros.data());
+}
+
+void TextureAtlas::place(int page, int x, int y, int w, int h, AtlasRegion &region) const
+{
+   region.page = page;
+   region.x = x;
+   region.y = y;
+   region.w = w;
+   region.h = h;
+   region.u0 = (float)x / size;
+   region.v0 = (float)y / size;
+   region.u1 = (float)(x + w) / size;
+   region.v1 = (float)(y + h) / size;
+}
+
+bool TextureAtlas::addToPage(int page, int w, int h, AtlasRegion &region)
+{
+   int x, y;
+   if (!isLive(page) || !pages[page].packer.pack(w + 1, h + 1, x, y))
+      return false;
+   place(page, x, y, w, h, region);
+   return true;
+}
+
+bool TextureAtlas::add(int w, int h, AtlasRegion &region)
+{
+   if (w + 1 > size || h + 1 > size)
+      return false;
+
+   for (size_t i = 0; i < pages.size(); i++)
+      if (addToPage((int)i, w, h, region))
+         return true;
+
+   if (limit > 0 && livePages() >= limit)
+      return false;
+   return addToPage(addPage(), w, h, region);
+}
+
+int TextureAtlas::addPage()
+{
+   Page fresh;
+   glGenTextures(1, &fresh.texture);
+   glBindTexture(GL_TEXTURE_2D, fresh.texture);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+   if (pixelFormat == GL_RED)
+   {
+      // single-channel pages read back as white with the texel as alpha
+      GLint swizzle[] = {GL_ONE, GL_ONE, GL_ONE, GL_RED};
+      glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+   }
+   zeroTexture(fresh.texture);
+   fresh.packer.reset(size, size);
+
+   // reuse a freed slot so that live page indices never move
+   int page = (int)pages.size();
+   for (size_t i = 0; i < pages.size(); i++)
+      if (!pages[i].texture)
+      {
+         page = (int)i;
+         break;
+      }
+   if (page == (int)pages.size())
+      pages.push_back(fresh);
+   else
+      pages[page] = fresh;
+   return page;
+}
+
+void TextureAtlas::clearPage(int page)
+{
+   if (!isLive(page))
+      return;
+   pages[page].packer.reset(size, size);
+   zeroTexture(pages[page].texture);
+}
+
+void TextureAtlas::freePage(int page)
+{
+   if (!isLive(page))
+      return;
+   glDeleteTextures(1, &pages[page].texture);
+   pages[page].texture = 0;
+}
+
+void TextureAtlas::copy(const AtlasRegion &from, const AtlasRegion &to)
+{
+   GLuint source = pages[from.page].texture, target = pages[to.page].texture;
+   if (GLAD_GL_ARB_copy_image && glCopyImageSubData)
+   {
+      glCopyImageSubData(source, GL_TEXTURE_2D, 0, from.x, from.y, 0,
+                         target, GL_TEXTURE_2D, 0, to.x, to.y, 0, from.w, from.h, 1);
+      return;
+   }
+
+   // blit between two framebuffers, leaving whatever the caller had bound in place
+   GLint readBinding, drawBinding;
+   glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readBinding);
+   glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawBinding);
+   GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+   if (!copyFramebuffers[0])
+      glGenFramebuffers(2, copyFramebuffers);
+
+   glBindFramebuffer(GL_READ_FRAMEBUFFER, copyFramebuffers[0]);
+   glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, source, 0);
+   glBindFramebuffer(GL_DRAW_FRAMEBUFFER, copyFramebuffers[1]);
+   glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+   glDisable(GL_SCISSOR_TEST);
+   glBlitFramebuffer(from.x, from.y, from.x + from.w, from.y + from.h,
+                     to.x, to.y, to.x + to.w, to.y + to.h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+   if (scissor)
+      glEnable(GL_SCISSOR_TEST);
+   glBindFramebuffer(GL_READ_FRAMEBUFFER, readBinding);
+   glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawBinding);
+}
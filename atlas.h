@@ -0,0 +1,89 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <vector>
+
+// Skyline rectangle packer for one atlas page
+class SkylinePacker
+{
+public:
+   void reset(int width, int height);
+   bool pack(int w, int h, int &x, int &y);
+
+private:
+   struct Node
+   {
+      int x, y, width;
+   };
+   int fit(size_t index, int w, int h) const;
+
+   std::vector<Node> skyline;
+   int width = 0;
+   int height = 0;
+};
+
+struct AtlasRegion
+{
+   int page;
+   int x, y, w, h;
+   float u0, v0, u1, v1;
+};
+
+// Small images share fixed-size texture pages so that quads using any of them
+// can go out in a single draw. The caller uploads pixels into the region.
+// Page indices stay valid until the page is freed; freed slots are reused.
+class TextureAtlas
+{
+public:
+   TextureAtlas(int pageSize, GLenum internalFormat, GLenum format);
+   ~TextureAtlas();
+   TextureAtlas(const TextureAtlas &) = delete;
+   TextureAtlas &operator=(const TextureAtlas &) = delete;
+
+   // Reserve w x h texels (plus a one texel gutter), adding a page when the
+   // others are full; fails once the page limit is reached
+   bool add(int w, int h, AtlasRegion &region);
+   // Start an empty page regardless of the limit; returns its index
+   int addPage();
+   // Reserve space on one particular page only
+   bool addToPage(int page, int w, int h, AtlasRegion &region);
+   // Forget everything on a page and zero its texels, keeping the texture
+   void clearPage(int page);
+   // Delete a page's texture; its index may come back from a later add
+   void freePage(int page);
+   // GPU-side copy of a region's texels to another region of the same size
+   void copy(const AtlasRegion &from, const AtlasRegion &to);
+
+   // 0 means unlimited
+   void setPageLimit(int pages) { limit = pages; }
+   int pageLimit() const { return limit; }
+   bool isLive(int page) const { return pages[page].texture != 0; }
+   GLuint texture(int page) const { return pages[page].texture; }
+   int pageCount() const { return (int)pages.size(); }
+   int livePages() const;
+   size_t pageBytes() const { return (size_t)size * size * (pixelFormat == GL_RED ? 1 : 4); }
+   int pageSize() const { return size; }
+   GLenum format() const { return pixelFormat; }
+   void release();
+
+private:
+   struct Page
+   {
+      GLuint texture;
+      SkylinePacker packer;
+   };
+
+   void place(int page, int x, int y, int w, int h, AtlasRegion &region) const;
+   void zeroTexture(GLuint texture) const;
+
+   std::vector<Page> pages;
+   int size;
+   GLenum internalFormat;
+   GLenum pixelFormat;
+   int limit = 0;
+   GLuint copyFramebuffers[2] = {0, 0};
+};
+
+#endif
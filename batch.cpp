@@ -0,0 +1,170 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace
+{
+struct CompactVertex
+{
+   int16_t x, y;
+   uint16_t u, v;
+   uint8_t color[4];
+};
+}
+
+static const ClipRect kUnbounded = {-1e30f, -1e30f, 1e30f, 1e30f};
+
+static size_t vertexSize(VertexFormat format)
+{
+   return format == VERTEX_COMPACT ? sizeof(CompactVertex) : 8 * sizeof(float);
+}
+
+void QuadBatch::init(VertexFormat vertexFormat)
+{
+   format = vertexFormat;
+   glGenVertexArrays(1, &vao);
+   glGenBuffers(1, &vbo);
+
+   glBindVertexArray(vao);
+   glBindBuffer(GL_ARRAY_BUFFER, vbo);
+   GLsizei stride = (GLsizei)vertexSize(format);
+   if (format == VERTEX_COMPACT)
+   {
+      // position, scaled back to window units by the shader
+      glVertexAttribPointer(0, 2, GL_SHORT, GL_FALSE, stride, (void *)offsetof(CompactVertex, x));
+      // tex coords
+      glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void *)offsetof(CompactVertex, u));
+      // color
+      glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void *)offsetof(CompactVertex, color));
+   }
+   else
+   {
+      glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride, (void *)0);
+      glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void *)(2 * sizeof(float)));
+      glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride, (void *)(4 * sizeof(float)));
+   }
+   glEnableVertexAttribArray(0);
+   glEnableVertexAttribArray(1);
+   glEnableVertexAttribArray(2);
+   glBindVertexArray(0);
+}
+
+void QuadBatch::release()
+{
+   glDeleteBuffers(1, &vbo);
+   glDeleteVertexArrays(1, &vao);
+   vbo = vao = 0;
+}
+
+void QuadBatch::begin(GLuint shaderProgram, const float *projection, int drawableWidth, bool premultiplied)
+{
+   program = shaderProgram;
+   texture = 0;
+   vertices.clear();
+   draws = 0;
+   culled = 0;
+
+   glUseProgram(program);
+   glUniformMatrix4fv(glGetUniformLocation(program, "uProjection"), 1, GL_FALSE, projection);
+   step = format == VERTEX_COMPACT ? positionStep(projection, drawableWidth) : 1.0f;
+   range = format == VERTEX_COMPACT ? positionRange(step) : kUnbounded;
+   glUniform1f(glGetUniformLocation(program, "uPositionScale"), step);
+   glUniform1i(glGetUniformLocation(program, "uTexture"), 0);
+   glEnable(GL_BLEND);
+   if (premultiplied)
+      glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+   else
+      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+void QuadBatch::add(GLuint quadTexture, float x, float y, float w, float h,
+                    float u0, float v0, float u1, float v1,
+                    float r, float g, float b, float a)
+{
+   // past the range of compact positions is far off screen, so it's trimmed like a clip
+   ClipRect clip = range;
+   if (clips && clips->active())
+   {
+      const ClipRect &current = clips->current();
+      clip = {std::max(clip.x0, current.x0), std::max(clip.y0, current.y0),
+              std::min(clip.x1, current.x1), std::min(clip.y1, current.y1)};
+   }
+   if (!clip.contains(x, y, x + w, y + h))
+   {
+      if (!clip.overlaps(x, y, x + w, y + h))
+      {
+         culled++;
+         return;
+      }
+      // trim the quad and move its texture coordinates by the same fraction
+      float x0 = std::max(x, clip.x0), y0 = std::max(y, clip.y0);
+      float x1 = std::min(x + w, clip.x1), y1 = std::min(y + h, clip.y1);
+      float du = (u1 - u0) / w, dv = (v1 - v0) / h;
+      u1 = u0 + (x1 - x) * du;
+      u0 += (x0 - x) * du;
+      v1 = v0 + (y1 - y) * dv;
+      v0 += (y0 - y) * dv;
+      x = x0;
+      y = y0;
+      w = x1 - x0;
+      h = y1 - y0;
+   }
+
+   if (quadTexture != texture)
+   {
+      flush();
+      texture = quadTexture;
+   }
+
+   // two triangles: bottom-left, top-left, top-right, then bottom-left, top-right, bottom-right
+   const float corners[6][4] = {{x, y + h, u0, v1}, {x, y, u0, v0}, {x + w, y, u1, v0},
+                                {x, y + h, u0, v1}, {x + w, y, u1, v0}, {x + w, y + h, u1, v1}};
+   size_t size = vertexSize(format);
+   size_t offset = vertices.size();
+   vertices.resize(offset + 6 * size);
+   unsigned char *out = vertices.data() + offset;
+   if (format == VERTEX_COMPACT)
+   {
+      CompactVertex vertex;
+      vertex.color[0] = packUnorm8(r);
+      vertex.color[1] = packUnorm8(g);
+      vertex.color[2] = packUnorm8(b);
+      vertex.color[3] = packUnorm8(a);
+      for (const float *corner : corners)
+      {
+         vertex.x = packPosition(corner[0], step);
+         vertex.y = packPosition(corner[1], step);
+         vertex.u = packUnorm16(corner[2]);
+         vertex.v = packUnorm16(corner[3]);
+         memcpy(out, &vertex, size);
+         out += size;
+      }
+      return;
+   }
+   for (const float *corner : corners)
+   {
+      float vertex[8] = {corner[0], corner[1], corner[2], corner[3], r, g, b, a};
+      memcpy(out, vertex, size);
+      out += size;
+   }
+}
+
+void QuadBatch::flush()
+{
+   if (vertices.empty())
+      return;
+
+   glUseProgram(program);
+   glActiveTexture(GL_TEXTURE0);
+   glBindTexture(GL_TEXTURE_2D, texture);
+   glBindVertexArray(vao);
+   glBindBuffer(GL_ARRAY_BUFFER, vbo);
+   // orphan the previous contents instead of waiting for the GPU to finish with them
+   glBufferData(GL_ARRAY_BUFFER, vertices.size(), vertices.data(), GL_STREAM_DRAW);
+   glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(vertices.size() / vertexSize(format)));
+
+   vertices.clear();
+   draws++;
+}
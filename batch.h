@@ -0,0 +1,50 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "clip.h"
+#include "vertex.h"
+
+#include <glad/glad.h>
+#include <vector>
+
+// Collects textured, tinted quads and draws each run that shares a texture
+// with a single call. Vertices match the text shader: pos, uv, rgba, packed
+// into 12 bytes in the compact format or 32 as floats.
+// With a clip stack attached, quads are trimmed to its current clip (texture
+// coordinates included) and ones entirely outside are dropped before they
+// can split a run.
+class QuadBatch
+{
+public:
+   void init(VertexFormat format = VERTEX_COMPACT);
+   void release();
+
+   // premultiplied selects ONE / ONE_MINUS_SRC_ALPHA blending for premultiplied textures
+   // drawableWidth is the target's width in device pixels
+   void begin(GLuint program, const float *projection, int drawableWidth, bool premultiplied);
+   void add(GLuint texture, float x, float y, float w, float h,
+            float u0, float v0, float u1, float v1,
+            float r = 1.0f, float g = 1.0f, float b = 1.0f, float a = 1.0f);
+   void flush();
+
+   // nullptr turns clipping off
+   void setClipStack(const ClipStack *stack) { clips = stack; }
+
+   int drawCalls() const { return draws; }
+   int rejected() const { return culled; }
+
+private:
+   GLuint vao = 0;
+   GLuint vbo = 0;
+   GLuint program = 0;
+   GLuint texture = 0;
+   const ClipStack *clips = nullptr;
+   VertexFormat format = VERTEX_COMPACT;
+   float step = 1.0f; // window units per stored position unit
+   ClipRect range = {-1e30f, -1e30f, 1e30f, 1e30f}; // quads are trimmed to what positions can hold
+   std::vector<unsigned char> vertices;
+   int draws = 0;
+   int culled = 0;
+};
+
+#endif
@@ -0,0 +1,24 @@
+# Frame times of two golden runs side by side: awk -f pgo_report.awk before.txt after.txt
+# Reads the scene rows of each runGoldenScenes table (name, median ms, ...).
+FNR == 1 { run++ }
+NF >= 7 && $2 ~ /^[0-9.]+$/ {
+   if (run == 1) {
+      before[$1] = $2
+      order[++scenes] = $1
+   } else
+      after[$1] = $2
+}
+END {
+   printf "%-16s %9s %9s %8s\n", "scene", "lto ms", "pgo ms", "change"
+   for (i = 1; i <= scenes; i++) {
+      scene = order[i]
+      if (!(scene in after))
+         continue
+      change = before[scene] > 0 ? (after[scene] - before[scene]) * 100 / before[scene] : 0
+      printf "%-16s %9.3f %9.3f %+7.1f%%\n", scene, before[scene], after[scene], change
+      total += before[scene]
+      totalAfter += after[scene]
+   }
+   if (total > 0)
+      printf "%-16s %9.3f %9.3f %+7.1f%%\n", "total", total, totalAfter, (totalAfter - total) * 100 / total
+}
@@ -0,0 +1,113 @@
+// Micro-benchmarks for the text scanning kernels: scalar vs the dispatched SIMD path.
+// Usage: bench_utf8 [file]   (without a file, 256 MB of synthetic text is used)
+#include "../document.h"
+#include "../utf8.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+static std::string makeText(size_t size, bool ascii)
+{
+   static const char *words[] = {"error", "request", "latency", "frame", "\xc3\xa9t\xc3\xa9", "\xe6\x97\xa5\xe5\xbf\x97", "\xf0\x9f\x93\x84"};
+   std::mt19937 rng(42);
+   std::string text;
+   text.reserve(size + 16);
+   size_t column = 0;
+   while (text.size() < size)
+   {
+      const char *word = words[rng() % (ascii ? 4 : 7)];
+      text += word;
+      column += 6;
+      if (column > 80)
+      {
+         text += '\n';
+         column = 0;
+      }
+      else
+         text += ' ';
+   }
+   text.resize(size);
+   // don't leave a sequence cut in half at the end
+   while (!text.empty() && (unsigned char)text.back() >= 0x80)
+      text.pop_back();
+   return text;
+}
+
+template <typename F>
+static void run(const char *kernel, const char *variant, const char *data, size_t size, F f)
+{
+   // best of three
+   double best = 1e30;
+   size_t result = 0;
+   for (int i = 0; i < 3; i++)
+   {
+      auto start = std::chrono::steady_clock::now();
+      result = f(data, size);
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      if (seconds < best)
+         best = seconds;
+   }
+   printf("  %-14s %-7s %8.2f GB/s   (%zu)\n", kernel, variant, size / best / 1e9, result);
+}
+
+static void benchBuffer(const char *label, const char *data, size_t size)
+{
+   printf("%s, %.1f MB\n", label, size / 1e6);
+   std::vector<uint32_t> codepoints(size);
+   const Utf8Kernels *sets[] = {&utf8ScalarKernels(), &utf8Kernels()};
+
+   for (const Utf8Kernels *k : sets)
+      run("countNewlines", k->name, data, size, [k](const char *d, size_t n) { return k->countNewlines(d, n); });
+   for (const Utf8Kernels *k : sets)
+      run("isAscii", k->name, data, size, [k](const char *d, size_t n) { return (size_t)k->isAscii(d, n); });
+   for (const Utf8Kernels *k : sets)
+      run("validate", k->name, data, size, [k](const char *d, size_t n) { return (size_t)k->validate(d, n); });
+   for (const Utf8Kernels *k : sets)
+      run("decode", k->name, data, size, [k, &codepoints](const char *d, size_t n) { return k->decode(d, n, codepoints.data()); });
+}
+
+int main(int argc, char *argv[])
+{
+   if (argc > 1)
+   {
+      MappedFile file;
+      if (!mapFile(argv[1], file))
+      {
+         fprintf(stderr, "Failed to open %s\n", argv[1]);
+         return -1;
+      }
+      benchBuffer(argv[1], file.data, file.size);
+
+      // the document index path: newline counting per block, as the background indexer does it
+      Document document;
+      auto start = std::chrono::steady_clock::now();
+      if (!document.open(argv[1]))
+      {
+         fprintf(stderr, "Failed to open %s as a document\n", argv[1]);
+         unmapFile(file);
+         return -1;
+      }
+      while (!document.isIndexed() && !document.indexFailed())
+         std::this_thread::yield();
+      if (document.indexFailed())
+      {
+         fprintf(stderr, "Failed to index %s\n", argv[1]);
+         unmapFile(file);
+         return -1;
+      }
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      printf("  document index   %8.2f GB/s   (%zu lines)\n", file.size / seconds / 1e9, document.lineCount());
+      unmapFile(file);
+      return 0;
+   }
+
+   const size_t size = 256 * 1024 * 1024;
+   std::string ascii = makeText(size, true);
+   benchBuffer("ASCII text", ascii.data(), ascii.size());
+   std::string mixed = makeText(size, false);
+   benchBuffer("Mixed UTF-8 text", mixed.data(), mixed.size());
+   return 0;
+}
@@ -0,0 +1,539 @@
+#include "capture.h"
+#include "drawlist.h"
+#include "raster.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+
+static const char kMagic[8] = {'E', 'N', 'G', 'C', 'A', 'P', 'T', 0};
+static const int kMaxTextureSize = 16384;
+
+static uint64_t fnv1a(const unsigned char *data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+   for (size_t i = 0; i < size; i++)
+      hash = (hash ^ data[i]) * 1099511628211ull;
+   return hash;
+}
+
+static uint64_t textureHash(const CapturedTexture &texture)
+{
+   int header[3] = {texture.width, texture.height, texture.channels};
+   uint64_t hash = fnv1a((const unsigned char *)header, sizeof(header));
+   return fnv1a(texture.texels.data(), texture.texels.size(), hash);
+}
+
+static bool sameClip(const ClipRect &a, const ClipRect &b)
+{
+   return a.x0 == b.x0 && a.y0 == b.y0 && a.x1 == b.x1 && a.y1 == b.y1;
+}
+
+// DrawList records unclipped commands under an infinite clip
+static bool unbounded(const ClipRect &clip)
+{
+   return clip.x0 <= -1e29f && clip.y0 <= -1e29f && clip.x1 >= 1e29f && clip.y1 >= 1e29f;
+}
+
+// -------- Serialization --------
+
+// Host byte order: captures are replayed on the kind of machine that took them
+struct ByteWriter
+{
+   std::vector<unsigned char> bytes;
+
+   void put(const void *data, size_t size)
+   {
+      const unsigned char *begin = (const unsigned char *)data;
+      bytes.insert(bytes.end(), begin, begin + size);
+   }
+   template <typename T>
+   void put(T value) { put(&value, sizeof(value)); }
+};
+
+// Every read is bounds checked; the first one past the end fails the rest
+struct ByteReader
+{
+   const unsigned char *data;
+   size_t size;
+   size_t offset = 0;
+   bool ok = true;
+
+   bool get(void *out, size_t count)
+   {
+      if (!ok || count > size - offset)
+         return ok = false;
+      memcpy(out, data + offset, count);
+      offset += count;
+      return true;
+   }
+   template <typename T>
+   T get()
+   {
+      T value{};
+      get(&value, sizeof(value));
+      return value;
+   }
+   size_t remaining() const { return size - offset; }
+};
+
+// PackBits: atlas pages are mostly empty, so runs of one byte dominate them
+static void packRuns(const std::vector<unsigned char> &in, ByteWriter &out)
+{
+   size_t i = 0;
+   while (i < in.size())
+   {
+      size_t run = 1;
+      while (i + run < in.size() && run < 128 && in[i + run] == in[i])
+         run++;
+      if (run >= 3)
+      {
+         out.put<uint8_t>((uint8_t)(257 - run));
+         out.put<uint8_t>(in[i]);
+         i += run;
+         continue;
+      }
+      // literals up to the next run of three
+      size_t start = i, count = 0;
+      while (i < in.size() && count < 128)
+      {
+         if (i + 2 < in.size() && in[i] == in[i + 1] && in[i] == in[i + 2])
+            break;
+         i++;
+         count++;
+      }
+      out.put<uint8_t>((uint8_t)(count - 1));
+      out.put(in.data() + start, count);
+   }
+}
+
+static bool unpackRuns(ByteReader &in, std::vector<unsigned char> &out)
+{
+   size_t filled = 0;
+   while (filled < out.size())
+   {
+      uint8_t header = in.get<uint8_t>();
+      if (!in.ok)
+         return false;
+      if (header < 128)
+      {
+         size_t count = (size_t)header + 1;
+         if (count > out.size() - filled || !in.get(out.data() + filled, count))
+            return false;
+         filled += count;
+      }
+      else if (header > 128)
+      {
+         size_t count = 257 - (size_t)header;
+         uint8_t value = in.get<uint8_t>();
+         if (!in.ok || count > out.size() - filled)
+            return false;
+         std::fill(out.begin() + filled, out.begin() + filled + count, value);
+         filled += count;
+      }
+   }
+   return true;
+}
+
+// -------- Collecting --------
+
+void FrameCapture::begin(int width, int height, float scale)
+{
+   frameWidth = width;
+   frameHeight = height;
+   frameScale = scale;
+   captured.clear();
+   clipTable.clear();
+   sources.clear();
+   stored.clear();
+}
+
+uint32_t FrameCapture::clipIndex(const ClipRect &clip)
+{
+   // consecutive commands mostly share one
+   for (size_t i = clipTable.size(); i-- > 0;)
+      if (sameClip(clipTable[i], clip))
+         return (uint32_t)i;
+   clipTable.push_back(clip);
+   return (uint32_t)clipTable.size() - 1;
+}
+
+void FrameCapture::addRect(int layer, const ClipRect &clip, float x, float y, float w, float h, const RectStyle &style)
+{
+   CapturedCommand command = {};
+   command.layer = layer;
+   command.pipeline = PIPELINE_RECTS;
+   command.texture = -1;
+   command.clip = clipIndex(clip);
+   command.x = x;
+   command.y = y;
+   command.w = w;
+   command.h = h;
+   command.style = style;
+   captured.push_back(command);
+}
+
+void FrameCapture::addQuad(int layer, uint8_t pipeline, GLuint texture, const ClipRect &clip, float x, float y,
+                           float w, float h, float u0, float v0, float u1, float v1, const float *color)
+{
+   CapturedCommand command = {};
+   command.layer = layer;
+   command.pipeline = pipeline;
+   command.texture = (int32_t)(std::find(sources.begin(), sources.end(), texture) - sources.begin());
+   if (command.texture == (int32_t)sources.size())
+      sources.push_back(texture);
+   command.clip = clipIndex(clip);
+   command.x = x;
+   command.y = y;
+   command.w = w;
+   command.h = h;
+   command.u0 = u0;
+   command.v0 = v0;
+   command.u1 = u1;
+   command.v1 = v1;
+   std::copy(color, color + 4, command.color);
+   captured.push_back(command);
+}
+
+void FrameCapture::end()
+{
+   // textures of equal content, e.g. a page reallocated mid-frame, are stored once
+   std::vector<int32_t> remap(sources.size());
+   glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+   glPixelStorei(GL_PACK_ALIGNMENT, 1);
+   for (size_t i = 0; i < sources.size(); i++)
+   {
+      CapturedTexture texture = {};
+      GLint width = 0, height = 0, format = 0;
+      glBindTexture(GL_TEXTURE_2D, sources[i]);
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+      texture.width = std::max(width, 0);
+      texture.height = std::max(height, 0);
+      texture.channels = format == GL_R8 ? 1 : 4;
+      texture.texels.resize((size_t)texture.width * texture.height * texture.channels);
+      if (!texture.texels.empty())
+         glGetTexImage(GL_TEXTURE_2D, 0, texture.channels == 1 ? GL_RED : GL_RGBA, GL_UNSIGNED_BYTE,
+                       texture.texels.data());
+      texture.hash = textureHash(texture);
+
+      auto same = std::find_if(stored.begin(), stored.end(), [&](const CapturedTexture &other)
+                               { return other.hash == texture.hash; });
+      remap[i] = (int32_t)(same - stored.begin());
+      if (same == stored.end())
+         stored.push_back(std::move(texture));
+   }
+   glBindTexture(GL_TEXTURE_2D, 0);
+
+   for (CapturedCommand &command : captured)
+      if (command.texture >= 0)
+         command.texture = remap[command.texture];
+   sources.clear();
+}
+
+// -------- Files --------
+
+bool FrameCapture::save(const std::string &path) const
+{
+   ByteWriter out;
+   out.put(kMagic, sizeof(kMagic));
+   out.put<uint32_t>(kVersion);
+   out.put<int32_t>(frameWidth);
+   out.put<int32_t>(frameHeight);
+   out.put<float>(frameScale);
+
+   out.put<uint32_t>((uint32_t)stored.size());
+   for (const CapturedTexture &texture : stored)
+   {
+      out.put<uint64_t>(texture.hash);
+      out.put<int32_t>(texture.width);
+      out.put<int32_t>(texture.height);
+      out.put<uint8_t>((uint8_t)texture.channels);
+      packRuns(texture.texels, out);
+   }
+
+   out.put<uint32_t>((uint32_t)clipTable.size());
+   for (const ClipRect &clip : clipTable)
+      out.put(clip);
+
+   out.put<uint32_t>((uint32_t)captured.size());
+   for (const CapturedCommand &command : captured)
+   {
+      out.put<int32_t>(command.layer);
+      out.put<uint8_t>(command.pipeline);
+      out.put<int32_t>(command.texture);
+      out.put<uint32_t>(command.clip);
+      float box[4] = {command.x, command.y, command.w, command.h};
+      out.put(box, sizeof(box));
+      if (command.pipeline == PIPELINE_RECTS)
+         out.put(command.style);
+      else
+      {
+         float uv[4] = {command.u0, command.v0, command.u1, command.v1};
+         out.put(uv, sizeof(uv));
+         out.put(command.color, sizeof(command.color));
+      }
+   }
+   out.put<uint64_t>(fnv1a(out.bytes.data(), out.bytes.size()));
+
+   // a crash while writing leaves the temporary behind, never a truncated capture
+   std::string temporary = path + ".tmp";
+   FILE *file = fopen(temporary.c_str(), "wb");
+   if (!file)
+   {
+      std::cerr << "Failed to write " << temporary << std::endl;
+      return false;
+   }
+   bool written = fwrite(out.bytes.data(), 1, out.bytes.size(), file) == out.bytes.size();
+   written = fflush(file) == 0 && written;
+   written = fclose(file) == 0 && written;
+   if (written && std::rename(temporary.c_str(), path.c_str()) != 0)
+   {
+      // Windows won't rename over an existing file
+      std::remove(path.c_str());
+      written = std::rename(temporary.c_str(), path.c_str()) == 0;
+   }
+   if (!written)
+   {
+      std::remove(temporary.c_str());
+      std::cerr << "Failed to write " << path << std::endl;
+   }
+   return written;
+}
+
+bool FrameCapture::load(const std::string &path)
+{
+   std::vector<unsigned char> bytes;
+   FILE *file = fopen(path.c_str(), "rb");
+   if (!file)
+   {
+      std::cerr << "Failed to open " << path << std::endl;
+      return false;
+   }
+   unsigned char chunk[65536];
+   size_t count;
+   while ((count = fread(chunk, 1, sizeof(chunk), file)) > 0)
+      bytes.insert(bytes.end(), chunk, chunk + count);
+   fclose(file);
+
+   uint64_t checksum = 0;
+   if (bytes.size() < sizeof(kMagic) + sizeof(checksum) || memcmp(bytes.data(), kMagic, sizeof(kMagic)) != 0)
+   {
+      std::cerr << path << " is not a frame capture" << std::endl;
+      return false;
+   }
+   size_t body = bytes.size() - sizeof(checksum);
+   memcpy(&checksum, bytes.data() + body, sizeof(checksum));
+   if (checksum != fnv1a(bytes.data(), body))
+   {
+      std::cerr << path << " is damaged (checksum mismatch)" << std::endl;
+      return false;
+   }
+
+   ByteReader in = {bytes.data(), body};
+   in.offset = sizeof(kMagic);
+   uint32_t version = in.get<uint32_t>();
+   if (version != kVersion)
+   {
+      std::cerr << path << " has capture version " << version << ", expected " << kVersion << std::endl;
+      return false;
+   }
+   int32_t width = in.get<int32_t>();
+   int32_t height = in.get<int32_t>();
+   begin(width, height, in.get<float>());
+
+   // every count is checked against the bytes that could still hold its entries
+   uint32_t textureCount = in.get<uint32_t>();
+   if (textureCount > in.remaining() / 17)
+      in.ok = false;
+   for (uint32_t i = 0; in.ok && i < textureCount; i++)
+   {
+      CapturedTexture texture;
+      texture.hash = in.get<uint64_t>();
+      texture.width = in.get<int32_t>();
+      texture.height = in.get<int32_t>();
+      texture.channels = in.get<uint8_t>();
+      if (texture.width < 0 || texture.width > kMaxTextureSize || texture.height < 0 ||
+          texture.height > kMaxTextureSize || (texture.channels != 1 && texture.channels != 4))
+      {
+         in.ok = false;
+         break;
+      }
+      texture.texels.resize((size_t)texture.width * texture.height * texture.channels);
+      in.ok = unpackRuns(in, texture.texels) && textureHash(texture) == texture.hash;
+      stored.push_back(std::move(texture));
+   }
+
+   uint32_t clipCount = in.ok ? in.get<uint32_t>() : 0;
+   if (clipCount > in.remaining() / sizeof(ClipRect))
+      in.ok = false;
+   for (uint32_t i = 0; in.ok && i < clipCount; i++)
+      clipTable.push_back(in.get<ClipRect>());
+
+   uint32_t commandCount = in.ok ? in.get<uint32_t>() : 0;
+   if (commandCount > in.remaining() / 29)
+      in.ok = false;
+   for (uint32_t i = 0; in.ok && i < commandCount; i++)
+   {
+      CapturedCommand command = {};
+      command.layer = in.get<int32_t>();
+      command.pipeline = in.get<uint8_t>();
+      command.texture = in.get<int32_t>();
+      command.clip = in.get<uint32_t>();
+      float box[4] = {};
+      in.get(box, sizeof(box));
+      command.x = box[0];
+      command.y = box[1];
+      command.w = box[2];
+      command.h = box[3];
+      if (command.pipeline == PIPELINE_RECTS)
+         command.style = in.get<RectStyle>();
+      else
+      {
+         float uv[4] = {};
+         in.get(uv, sizeof(uv));
+         command.u0 = uv[0];
+         command.v0 = uv[1];
+         command.u1 = uv[2];
+         command.v1 = uv[3];
+         in.get(command.color, sizeof(command.color));
+      }
+      bool textured = command.pipeline == PIPELINE_IMAGES || command.pipeline == PIPELINE_TEXT;
+      if (command.clip >= clipTable.size() || (command.pipeline != PIPELINE_RECTS && !textured) ||
+          (textured && (command.texture < 0 || command.texture >= (int32_t)stored.size())))
+         in.ok = false;
+      captured.push_back(command);
+   }
+
+   if (!in.ok || in.remaining() != 0)
+   {
+      std::cerr << path << " is malformed" << std::endl;
+      begin(0, 0, 1.0f);
+      return false;
+   }
+   return true;
+}
+
+// -------- Replay --------
+
+std::vector<GLuint> FrameCapture::createTextures() const
+{
+   std::vector<GLuint> textures(stored.size(), 0);
+   if (textures.empty())
+      return textures;
+   glGenTextures((GLsizei)textures.size(), textures.data());
+   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+   for (size_t i = 0; i < stored.size(); i++)
+   {
+      // set up like the atlas pages they came from
+      const CapturedTexture &texture = stored[i];
+      glBindTexture(GL_TEXTURE_2D, textures[i]);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      if (texture.channels == 1)
+      {
+         GLint swizzle[] = {GL_ONE, GL_ONE, GL_ONE, GL_RED};
+         glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+      }
+      glTexImage2D(GL_TEXTURE_2D, 0, texture.channels == 1 ? GL_R8 : GL_RGBA8, texture.width, texture.height, 0,
+                   texture.channels == 1 ? GL_RED : GL_RGBA, GL_UNSIGNED_BYTE,
+                   texture.texels.empty() ? nullptr : texture.texels.data());
+   }
+   glBindTexture(GL_TEXTURE_2D, 0);
+   return textures;
+}
+
+void FrameCapture::replay(DrawList &list, ClipStack &clips, const std::vector<GLuint> &textures) const
+{
+   // commands are in recording order, so the list batches them as it did the original frame
+   uint32_t current = UINT32_MAX;
+   for (const CapturedCommand &command : captured)
+   {
+      if (command.clip != current)
+      {
+         current = command.clip;
+         const ClipRect &clip = clipTable[current];
+         clips.reset();
+         if (!unbounded(clip))
+            clips.push(clip.x0, clip.y0, clip.x1 - clip.x0, clip.y1 - clip.y0);
+      }
+      list.setLayer(command.layer);
+      if (command.pipeline == PIPELINE_RECTS)
+         list.rect(command.x, command.y, command.w, command.h, command.style);
+      else
+         list.quad((DrawPipeline)command.pipeline, textures[command.texture], command.x, command.y, command.w,
+                   command.h, command.u0, command.v0, command.u1, command.v1, command.color[0], command.color[1],
+                   command.color[2], command.color[3]);
+   }
+   clips.reset();
+   list.setLayer(0);
+}
+
+int FrameCapture::replay(SoftwareRenderer &renderer) const
+{
+   // the software renderer draws in order; layers first, like DrawList::submit
+   std::vector<uint32_t> order(captured.size());
+   std::iota(order.begin(), order.end(), 0u);
+   std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b)
+                    { return captured[a].layer < captured[b].layer; });
+
+   // device pixels, where the glyph coverage was rasterized 1:1
+   const float s = frameScale;
+   int skipped = 0;
+   uint32_t current = UINT32_MAX;
+   for (uint32_t index : order)
+   {
+      const CapturedCommand &command = captured[index];
+      if (command.clip != current)
+      {
+         current = command.clip;
+         const ClipRect &clip = clipTable[current];
+         if (unbounded(clip))
+            renderer.resetScissor();
+         else
+         {
+            int x0 = (int)std::lround(clip.x0 * s), y0 = (int)std::lround(clip.y0 * s);
+            renderer.setScissor(x0, y0, (int)std::lround(clip.x1 * s) - x0, (int)std::lround(clip.y1 * s) - y0);
+         }
+      }
+
+      if (command.pipeline == PIPELINE_RECTS)
+      {
+         RectStyle style = command.style;
+         for (float &radius : style.radii)
+            radius *= s;
+         style.borderWidth *= s;
+         style.shadowBlur *= s;
+         style.shadowOffsetX *= s;
+         style.shadowOffsetY *= s;
+         renderer.drawRect(command.x * s, command.y * s, command.w * s, command.h * s, style);
+         continue;
+      }
+
+      const CapturedTexture &texture = stored[command.texture];
+      int tx = (int)std::lround(command.u0 * texture.width), ty = (int)std::lround(command.v0 * texture.height);
+      int tw = (int)std::lround(command.u1 * texture.width) - tx, th = (int)std::lround(command.v1 * texture.height) - ty;
+      if (command.pipeline != PIPELINE_TEXT || texture.channels != 1 || tx < 0 || ty < 0 || tw <= 0 || th <= 0 ||
+          tx + tw > texture.width || ty + th > texture.height)
+      {
+         skipped++;
+         continue;
+      }
+      auto unorm = [](float v)
+      {
+         return (Uint8)std::lround(std::min(std::max(v, 0.0f), 1.0f) * 255.0f);
+      };
+      SDL_Color color = {unorm(command.color[0]), unorm(command.color[1]), unorm(command.color[2]),
+                         unorm(command.color[3])};
+      renderer.drawCoverage(texture.texels.data() + (size_t)ty * texture.width + tx, texture.width,
+                            (int)std::lround(command.x * s), (int)std::lround(command.y * s), tw, th, color);
+   }
+   renderer.resetScissor();
+   return skipped;
+}
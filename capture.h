@@ -0,0 +1,87 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "clip.h"
+#include "rects.h"
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class DrawList;
+class SoftwareRenderer;
+
+struct CapturedTexture
+{
+   uint64_t hash; // FNV-1a of the size, channels and texels
+   int width, height;
+   int channels;  // 1 for glyph coverage, 4 for premultiplied RGBA
+   std::vector<unsigned char> texels;
+};
+
+struct CapturedCommand
+{
+   int32_t layer;
+   uint8_t pipeline; // DrawPipeline
+   int32_t texture;  // into FrameCapture::textures(), -1 for rects
+   uint32_t clip;    // into FrameCapture::clips()
+   float x, y, w, h;
+   float u0, v0, u1, v1;
+   float color[4];   // quads
+   RectStyle style;  // rects
+};
+
+// One frame's draw list: every rect, image and glyph quad with its layer and
+// clip, and each texture they sample stored once by content hash. A capture
+// written by a slow frame replays the same UI state offscreen, through GL or
+// the software renderer, as a benchmark input.
+//
+// The file is written to a temporary name and renamed into place, so a crash
+// mid-write never leaves a truncated capture behind, and it ends in a
+// checksum that load() verifies before trusting any count in it.
+class FrameCapture
+{
+public:
+   static constexpr uint32_t kVersion = 1;
+
+   // Start over for a frame of a width x height window with scale device
+   // pixels per unit; DrawList::setCapture then fills it on submit
+   void begin(int width, int height, float scale);
+   void addRect(int layer, const ClipRect &clip, float x, float y, float w, float h, const RectStyle &style);
+   void addQuad(int layer, uint8_t pipeline, GLuint texture, const ClipRect &clip, float x, float y, float w, float h,
+                float u0, float v0, float u1, float v1, const float *color);
+   // Read back the textures the frame sampled; needs the frame's GL context, before anything changes them
+   void end();
+
+   bool save(const std::string &path) const;
+   bool load(const std::string &path);
+
+   // Record the captured commands into a draw list, clipped through clips,
+   // sampling textures made by createTextures()
+   void replay(DrawList &list, ClipStack &clips, const std::vector<GLuint> &textures) const;
+   // The software renderer draws rects through its distance field and glyph
+   // coverage 1:1; image quads are skipped and counted
+   int replay(SoftwareRenderer &renderer) const;
+
+   std::vector<GLuint> createTextures() const;
+
+   int width() const { return frameWidth; }
+   int height() const { return frameHeight; }
+   float scale() const { return frameScale; }
+   const std::vector<CapturedCommand> &commands() const { return captured; }
+   const std::vector<CapturedTexture> &textures() const { return stored; }
+   const std::vector<ClipRect> &clips() const { return clipTable; }
+
+private:
+   uint32_t clipIndex(const ClipRect &clip);
+
+   int frameWidth = 0, frameHeight = 0;
+   float frameScale = 1.0f;
+   std::vector<CapturedCommand> captured;
+   std::vector<ClipRect> clipTable;
+   std::vector<GLuint> sources; // GL textures while collecting, by the index commands use
+   std::vector<CapturedTexture> stored;
+};
+
+#endif
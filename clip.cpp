@@ -0,0 +1,34 @@
+#include "clip.h"
+
+#include <algorithm>
+
+static const float kUnbounded = 1e30f;
+
+ClipStack::ClipStack()
+{
+   reset();
+}
+
+void ClipStack::push(float x, float y, float w, float h)
+{
+   const ClipRect &outer = stack.back();
+   ClipRect clip = {std::max(x, outer.x0), std::max(y, outer.y0), std::min(x + w, outer.x1), std::min(y + h, outer.y1)};
+   // keep an empty clip well-formed so every test against it fails
+   if (clip.empty())
+   {
+      clip.x1 = clip.x0;
+      clip.y1 = clip.y0;
+   }
+   stack.push_back(clip);
+}
+
+void ClipStack::pop()
+{
+   if (stack.size() > 1)
+      stack.pop_back();
+}
+
+void ClipStack::reset()
+{
+   stack.assign(1, {-kUnbounded, -kUnbounded, kUnbounded, kUnbounded});
+}
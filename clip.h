@@ -0,0 +1,43 @@
+#ifndef CLIP_H
+#define CLIP_H
+
+#include <vector>
+
+// Axis-aligned clip in pixels, top-left origin; x1 and y1 are exclusive
+struct ClipRect
+{
+   float x0, y0, x1, y1;
+
+   bool empty() const { return x0 >= x1 || y0 >= y1; }
+   bool contains(float left, float top, float right, float bottom) const
+   {
+      return left >= x0 && top >= y0 && right <= x1 && bottom <= y1;
+   }
+   bool overlaps(float left, float top, float right, float bottom) const
+   {
+      return left < x1 && top < y1 && right > x0 && bottom > y0;
+   }
+};
+
+// Nested clip rectangles for panels and menus. Each push intersects with the
+// current clip, so the top of the stack is always the effective one. The
+// batches read it as primitives are added: whatever falls outside is dropped
+// there, and whatever straddles an edge is trimmed to it, which keeps clip
+// changes from costing a scissor change or a separate draw.
+class ClipStack
+{
+public:
+   ClipStack();
+
+   void push(float x, float y, float w, float h);
+   void pop();
+   void reset();
+
+   const ClipRect &current() const { return stack.back(); }
+   bool active() const { return stack.size() > 1; }
+
+private:
+   std::vector<ClipRect> stack; // the bottom entry is unbounded
+};
+
+#endif
@@ -0,0 +1,481 @@
+#include "document.h"
+#include "utf8.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// -------- File mapping --------
+
+bool mapFile(const char *path, MappedFile &file)
+{
+#ifdef _WIN32
+   HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+   if (handle == INVALID_HANDLE_VALUE)
+      return false;
+
+   LARGE_INTEGER size;
+   if (!GetFileSizeEx(handle, &size))
+   {
+      CloseHandle(handle);
+      return false;
+   }
+   file.fileHandle = handle;
+   file.size = (size_t)size.QuadPart;
+   if (file.size == 0)
+      return true;
+
+   HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+   if (!mapping)
+   {
+      unmapFile(file);
+      return false;
+   }
+   file.mappingHandle = mapping;
+   file.data = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+   int fd = ::open(path, O_RDONLY);
+   if (fd < 0)
+      return false;
+
+   struct stat st;
+   if (fstat(fd, &st) != 0)
+   {
+      ::close(fd);
+      return false;
+   }
+   file.fd = fd;
+   file.size = (size_t)st.st_size;
+   if (file.size == 0)
+      return true;
+
+   void *data = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (data != MAP_FAILED)
+   {
+      // the viewport jumps around; don't let the kernel read ahead megabytes
+      madvise(data, file.size, MADV_RANDOM);
+      file.data = (const char *)data;
+   }
+#endif
+   if (!file.data)
+   {
+      unmapFile(file);
+      return false;
+   }
+   return true;
+}
+
+void unmapFile(MappedFile &file)
+{
+#ifdef _WIN32
+   if (file.data)
+      UnmapViewOfFile(file.data);
+   if (file.mappingHandle)
+      CloseHandle((HANDLE)file.mappingHandle);
+   if (file.fileHandle)
+      CloseHandle((HANDLE)file.fileHandle);
+   file.mappingHandle = nullptr;
+   file.fileHandle = nullptr;
+#else
+   if (file.data)
+      munmap((void *)file.data, file.size);
+   if (file.fd >= 0)
+      ::close(file.fd);
+   file.fd = -1;
+#endif
+   file.data = nullptr;
+   file.size = 0;
+}
+
+// Map a chunk for the indexer only, so scanned pages leave the working set when it is unmapped
+static const char *mapRange(const MappedFile &file, size_t offset, size_t length)
+{
+#ifdef _WIN32
+   uint64_t off = offset;
+   return (const char *)MapViewOfFile((HANDLE)file.mappingHandle, FILE_MAP_READ,
+                                      (DWORD)(off >> 32), (DWORD)(off & 0xFFFFFFFF), length);
+#else
+   void *data = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file.fd, (off_t)offset);
+   if (data == MAP_FAILED)
+      return nullptr;
+   madvise(data, length, MADV_SEQUENTIAL);
+   return (const char *)data;
+#endif
+}
+
+static void unmapRange(const char *data, size_t length)
+{
+#ifdef _WIN32
+   (void)length;
+   UnmapViewOfFile(data);
+#else
+   munmap((void *)data, length);
+#endif
+}
+
+// -------- Document --------
+
+Document::~Document()
+{
+   close();
+}
+
+bool Document::open(const char *path)
+{
+   close();
+
+   if (!mapFile(path, file))
+   {
+      std::cerr << "Failed to open " << path << std::endl;
+      return false;
+   }
+   filePath = path;
+   opened = true;
+
+   if (file.size > 0)
+      pieces.push_back({false, 0, file.size, Document::npos});
+
+   size_t blocks = (file.size + kBlockSize - 1) / kBlockSize;
+   newlinesThrough.assign(blocks, 0);
+   indexedBlocks.store(0);
+   stopIndexing.store(false);
+   indexingFailed.store(false);
+   if (blocks > 0)
+      indexer = std::thread(&Document::indexLoop, this);
+   return true;
+}
+
+void Document::close()
+{
+   stopIndexing.store(true);
+   if (indexer.joinable())
+      indexer.join();
+
+   unmapFile(file);
+   pieces.clear();
+   addBuffer.clear();
+   newlinesThrough.clear();
+   indexedBlocks.store(0);
+   filePath.clear();
+   opened = false;
+   editVersion++;
+}
+
+void Document::indexLoop()
+{
+   size_t blocks = newlinesThrough.size();
+   uint64_t total = 0;
+
+   for (size_t chunk = 0; chunk < file.size && !stopIndexing.load(); chunk += kChunkSize)
+   {
+      size_t length = std::min(kChunkSize, file.size - chunk);
+      const char *data = mapRange(file, chunk, length);
+      if (!data)
+      {
+         std::cerr << "Failed to map " << filePath << " at " << chunk << std::endl;
+         indexingFailed.store(true, std::memory_order_release);
+         return;
+      }
+
+      for (size_t offset = 0; offset < length; offset += kBlockSize)
+      {
+         size_t block = (chunk + offset) / kBlockSize;
+         total += utf8CountNewlines(data + offset, std::min(kBlockSize, length - offset));
+         newlinesThrough[block] = total;
+         indexedBlocks.store(std::min(block + 1, blocks), std::memory_order_release);
+      }
+      unmapRange(data, length);
+   }
+}
+
+bool Document::isIndexed() const
+{
+   return indexedBlocks.load(std::memory_order_acquire) == newlinesThrough.size();
+}
+
+size_t Document::size() const
+{
+   size_t total = 0;
+   for (const Piece &piece : pieces)
+      total += piece.length;
+   return total;
+}
+
+size_t Document::lineCount() const
+{
+   if (!opened)
+      return 0;
+
+   // unedited file: read the count straight from the index as it grows
+   if (pieces.size() == 1 && !pieces[0].added && pieces[0].length == file.size)
+   {
+      size_t indexed = indexedBlocks.load(std::memory_order_acquire);
+      return indexed ? (size_t)newlinesThrough[indexed - 1] + 1 : 1;
+   }
+
+   size_t lines = 1;
+   for (const Piece &piece : pieces)
+   {
+      size_t count = countNewlines(piece);
+      if (count == npos)
+         break; // rest of the file isn't indexed yet
+      lines += count;
+   }
+   return lines;
+}
+
+const char *Document::pieceData(const Piece &piece) const
+{
+   return piece.added ? addBuffer.data() + piece.offset : file.data + piece.offset;
+}
+
+size_t Document::blockNewlines(size_t block) const
+{
+   return (size_t)(newlinesThrough[block] - (block ? newlinesThrough[block - 1] : 0));
+}
+
+// Newlines in a piece, or npos if part of it hasn't been indexed
+size_t Document::countNewlines(const Piece &piece) const
+{
+   if (piece.newlines != npos)
+      return piece.newlines;
+
+   if (piece.added)
+   {
+      piece.newlines = utf8CountNewlines(pieceData(piece), piece.length);
+      return piece.newlines;
+   }
+
+   size_t indexed = indexedBlocks.load(std::memory_order_acquire);
+   size_t begin = piece.offset;
+   size_t end = piece.offset + piece.length;
+   if ((end - 1) / kBlockSize >= indexed)
+      return npos;
+
+   // edges of partial blocks are scanned, whole blocks come from the index
+   size_t firstFull = (begin + kBlockSize - 1) / kBlockSize;
+   size_t lastFull = end / kBlockSize; // exclusive
+   if (firstFull >= lastFull)
+   {
+      piece.newlines = utf8CountNewlines(file.data + begin, end - begin);
+      return piece.newlines;
+   }
+
+   size_t count = utf8CountNewlines(file.data + begin, firstFull * kBlockSize - begin);
+   count += (size_t)(newlinesThrough[lastFull - 1] - (firstFull ? newlinesThrough[firstFull - 1] : 0));
+   count += utf8CountNewlines(file.data + lastFull * kBlockSize, end - lastFull * kBlockSize);
+   piece.newlines = count;
+   return count;
+}
+
+// Position inside the piece of its n-th newline (1-based), or npos with count set to
+// the newlines that were passed
+size_t Document::findNewline(const Piece &piece, size_t n, size_t &count) const
+{
+   const char *data = pieceData(piece);
+   size_t indexed = piece.added ? 0 : indexedBlocks.load(std::memory_order_acquire);
+   size_t pos = 0;
+   count = 0;
+
+   while (pos < piece.length)
+   {
+      size_t absolute = piece.offset + pos;
+      size_t block = absolute / kBlockSize;
+      size_t chunkEnd = piece.length;
+      if (!piece.added)
+      {
+         chunkEnd = std::min(piece.length, (block + 1) * kBlockSize - piece.offset);
+         bool wholeBlock = absolute % kBlockSize == 0 && chunkEnd - pos == kBlockSize;
+         if (wholeBlock && block < indexed && count + blockNewlines(block) < n)
+         {
+            count += blockNewlines(block);
+            pos = chunkEnd;
+            continue;
+         }
+      }
+
+      const char *end = data + chunkEnd;
+      const char *p = data + pos;
+      while ((p = (const char *)memchr(p, '\n', end - p)) != nullptr)
+      {
+         if (++count == n)
+            return p - data;
+         p++;
+      }
+      pos = chunkEnd;
+   }
+   return npos;
+}
+
+size_t Document::lineOffset(size_t line) const
+{
+   if (line == 0)
+      return 0;
+
+   size_t base = 0;
+   size_t remaining = line;
+   for (const Piece &piece : pieces)
+   {
+      if (piece.newlines != npos && piece.newlines < remaining)
+      {
+         remaining -= piece.newlines;
+         base += piece.length;
+         continue;
+      }
+
+      size_t count = 0;
+      size_t pos = findNewline(piece, remaining, count);
+      if (pos != npos)
+         return base + pos + 1;
+
+      piece.newlines = count;
+      remaining -= count;
+      base += piece.length;
+   }
+   return npos;
+}
+
+std::string Document::text(size_t offset, size_t length) const
+{
+   std::string result;
+   size_t base = 0;
+   for (const Piece &piece : pieces)
+   {
+      if (length == 0)
+         break;
+      if (offset < base + piece.length)
+      {
+         size_t start = offset - base;
+         size_t take = std::min(length, piece.length - start);
+         result.append(pieceData(piece) + start, take);
+         offset += take;
+         length -= take;
+      }
+      base += piece.length;
+   }
+   return result;
+}
+
+std::string Document::line(size_t line, size_t maxLength) const
+{
+   std::vector<std::string> result;
+   lines(line, 1, result, maxLength);
+   return result.empty() ? std::string() : result[0];
+}
+
+void Document::lines(size_t first, size_t count, std::vector<std::string> &out, size_t maxLength) const
+{
+   out.clear();
+   size_t offset = lineOffset(first);
+   if (offset == npos || count == 0)
+      return;
+
+   // one lookup for the first line, then a single forward pass over the pieces
+   out.emplace_back();
+   size_t base = 0;
+   for (const Piece &piece : pieces)
+   {
+      if (offset >= base + piece.length)
+      {
+         base += piece.length;
+         continue;
+      }
+
+      const char *data = pieceData(piece);
+      size_t pos = offset - base;
+      while (pos < piece.length)
+      {
+         const char *start = data + pos;
+         const char *newline = (const char *)memchr(start, '\n', piece.length - pos);
+         size_t length = newline ? (size_t)(newline - start) : piece.length - pos;
+         std::string &current = out.back();
+         if (current.size() < maxLength)
+            current.append(start, std::min(length, maxLength - current.size()));
+         pos += length;
+         if (!newline)
+            break;
+
+         pos++;
+         if (!current.empty() && current.back() == '\r')
+            current.pop_back();
+         if (out.size() == count)
+            return;
+         out.emplace_back();
+      }
+      base += piece.length;
+      offset = base;
+   }
+
+   if (!out.back().empty() && out.back().back() == '\r')
+      out.back().pop_back();
+}
+
+// Split the piece containing offset so that a piece starts exactly there; returns its index
+size_t Document::splitPiece(size_t offset)
+{
+   size_t base = 0;
+   for (size_t i = 0; i < pieces.size(); i++)
+   {
+      Piece &piece = pieces[i];
+      if (offset == base)
+         return i;
+      if (offset < base + piece.length)
+      {
+         size_t head = offset - base;
+         Piece tail = {piece.added, piece.offset + head, piece.length - head, npos};
+         piece.length = head;
+         piece.newlines = npos;
+         pieces.insert(pieces.begin() + i + 1, tail);
+         return i + 1;
+      }
+      base += piece.length;
+   }
+   return pieces.size();
+}
+
+void Document::insert(size_t offset, const std::string &text)
+{
+   if (!opened || text.empty())
+      return;
+
+   size_t index = splitPiece(std::min(offset, size()));
+   Piece piece = {true, addBuffer.size(), text.size(), npos};
+   addBuffer += text;
+
+   // typing appends to the previous add piece instead of growing the table
+   if (index > 0)
+   {
+      Piece &previous = pieces[index - 1];
+      if (previous.added && previous.offset + previous.length == piece.offset)
+      {
+         previous.length += piece.length;
+         previous.newlines = npos;
+         editVersion++;
+         return;
+      }
+   }
+   pieces.insert(pieces.begin() + index, piece);
+   editVersion++;
+}
+
+void Document::erase(size_t offset, size_t length)
+{
+   if (!opened || length == 0)
+      return;
+
+   size_t first = splitPiece(offset);
+   size_t last = splitPiece(std::min(offset + length, size()));
+   pieces.erase(pieces.begin() + first, pieces.begin() + last);
+   editVersion++;
+}
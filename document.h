@@ -0,0 +1,100 @@
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Read-only memory mapping of a whole file
+struct MappedFile
+{
+   const char *data = nullptr;
+   size_t size = 0;
+#ifdef _WIN32
+   void *fileHandle = nullptr;
+   void *mappingHandle = nullptr;
+#else
+   int fd = -1;
+#endif
+};
+
+bool mapFile(const char *path, MappedFile &file);
+void unmapFile(MappedFile &file);
+
+// A text document backed by a mapped file plus a piece table of edits.
+// The file is never copied: lines are read straight from the mapping, so only
+// the pages the viewport touches become resident. Newlines are counted per
+// 64 KB block by a background thread that maps and drops one chunk at a time.
+class Document
+{
+public:
+   static constexpr size_t kBlockSize = 64 * 1024;
+   static constexpr size_t kChunkSize = 16 * 1024 * 1024;
+   static constexpr size_t npos = (size_t)-1;
+
+   Document() = default;
+   ~Document();
+   Document(const Document &) = delete;
+   Document &operator=(const Document &) = delete;
+
+   bool open(const char *path);
+   void close();
+
+   bool isOpen() const { return opened; }
+   bool isIndexed() const;
+   // The background index gave up (a range of the file couldn't be mapped); it won't complete
+   bool indexFailed() const { return indexingFailed.load(std::memory_order_acquire); }
+   const std::string &path() const { return filePath; }
+   uint64_t version() const { return editVersion; }
+
+   // Current length in bytes, including edits
+   size_t size() const;
+   // Lines known so far; grows while the background index is being built
+   size_t lineCount() const;
+   // Offset of the first byte of a line, or npos if it is not known yet
+   size_t lineOffset(size_t line) const;
+   // Text of a line without its terminator, truncated to maxLength bytes
+   std::string line(size_t line, size_t maxLength = 1024) const;
+   // Up to count consecutive lines starting at first
+   void lines(size_t first, size_t count, std::vector<std::string> &out, size_t maxLength = 1024) const;
+   std::string text(size_t offset, size_t length) const;
+
+   void insert(size_t offset, const std::string &text);
+   void erase(size_t offset, size_t length);
+
+private:
+   struct Piece
+   {
+      bool added;
+      size_t offset;
+      size_t length;
+      mutable size_t newlines; // npos until counted
+   };
+
+   const char *pieceData(const Piece &piece) const;
+   size_t blockNewlines(size_t block) const;
+   size_t countNewlines(const Piece &piece) const;
+   size_t findNewline(const Piece &piece, size_t n, size_t &count) const;
+   size_t splitPiece(size_t offset);
+   void indexLoop();
+
+   MappedFile file;
+   std::string filePath;
+   bool opened = false;
+
+   std::vector<Piece> pieces;
+   std::string addBuffer;
+   uint64_t editVersion = 0;
+
+   // newlinesThrough[b] = newlines in blocks 0..b, valid for b < indexedBlocks
+   std::vector<uint64_t> newlinesThrough;
+   std::atomic<size_t> indexedBlocks{0};
+   std::atomic<bool> stopIndexing{false};
+   std::atomic<bool> indexingFailed{false};
+   std::thread indexer;
+};
+
+#endif
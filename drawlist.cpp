@@ -0,0 +1,224 @@
+#include "drawlist.h"
+#include "capture.h"
+
+#include <algorithm>
+#include <numeric>
+
+static const ClipRect kUnclipped = {-1e30f, -1e30f, 1e30f, 1e30f};
+
+static bool sameClip(const ClipRect &a, const ClipRect &b)
+{
+   return a.x0 == b.x0 && a.y0 == b.y0 && a.x1 == b.x1 && a.y1 == b.y1;
+}
+
+bool DrawList::framebufferIsSRGB()
+{
+   GLint binding = 0, encoding = GL_LINEAR;
+   glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &binding);
+   glGetFramebufferAttachmentParameteriv(GL_DRAW_FRAMEBUFFER, binding ? GL_COLOR_ATTACHMENT0 : GL_BACK_LEFT,
+                                         GL_FRAMEBUFFER_ATTACHMENT_COLOR_ENCODING, &encoding);
+   return encoding == GL_SRGB;
+}
+
+void DrawList::init(GLuint rects, GLuint quads, VertexFormat format)
+{
+   rectProgram = rects;
+   quadProgram = quads;
+   rectBatch.init(format);
+   quadBatch.init(format);
+   rectBatch.setClipStack(&replayClips);
+   quadBatch.setClipStack(&replayClips);
+}
+
+void DrawList::release()
+{
+   rectBatch.release();
+   quadBatch.release();
+   commands.clear();
+   rects.clear();
+   quads.clear();
+}
+
+void DrawList::rect(float x, float y, float w, float h, float r, float g, float b, float a)
+{
+   RectStyle style;
+   style.fill[0] = r;
+   style.fill[1] = g;
+   style.fill[2] = b;
+   style.fill[3] = a;
+   rect(x, y, w, h, style);
+}
+
+void DrawList::rect(float x, float y, float w, float h, const RectStyle &style)
+{
+   rects.push_back({x, y, w, h, style});
+   record(PIPELINE_RECTS, 0, rectExtent(x, y, w, h, style), (uint32_t)rects.size() - 1);
+}
+
+void DrawList::quad(DrawPipeline pipeline, GLuint texture, float x, float y, float w, float h,
+                    float u0, float v0, float u1, float v1, float r, float g, float b, float a)
+{
+   quads.push_back({x, y, w, h, u0, v0, u1, v1, r, g, b, a});
+   record(pipeline, texture, {x, y, x + w, y + h}, (uint32_t)quads.size() - 1);
+}
+
+void DrawList::record(DrawPipeline pipeline, GLuint texture, ClipRect bounds, uint32_t item)
+{
+   ClipRect clip = kUnclipped;
+   if (clips && clips->active())
+   {
+      clip = clips->current();
+      if (!clip.overlaps(bounds.x0, bounds.y0, bounds.x1, bounds.y1))
+      {
+         // the item stays behind unreferenced until the list is cleared
+         culled++;
+         return;
+      }
+      bounds = {std::max(bounds.x0, clip.x0), std::max(bounds.y0, clip.y0),
+                std::min(bounds.x1, clip.x1), std::min(bounds.y1, clip.y1)};
+   }
+   commands.push_back({layer, pipeline, texture, clip, bounds, item});
+}
+
+void DrawList::beginPipeline(DrawPipeline pipeline, const float *projection, int drawableWidth)
+{
+   if (pipeline == PIPELINE_RECTS)
+   {
+      rectBatch.begin(rectProgram, projection, drawableWidth);
+      return;
+   }
+   quadBatch.begin(quadProgram, projection, drawableWidth, pipeline == PIPELINE_IMAGES);
+   linear = pipeline == PIPELINE_TEXT && srgbTarget;
+   glUniform1i(glGetUniformLocation(quadProgram, "uLinearBlend"), linear);
+   if (linear)
+      glEnable(GL_FRAMEBUFFER_SRGB);
+}
+
+void DrawList::endPipeline(DrawPipeline pipeline)
+{
+   if (pipeline == PIPELINE_RECTS)
+   {
+      rectBatch.flush();
+      draws += rectBatch.drawCalls();
+      return;
+   }
+   quadBatch.flush();
+   draws += quadBatch.drawCalls();
+   // everything else writes sRGB values directly
+   if (linear)
+   {
+      glDisable(GL_FRAMEBUFFER_SRGB);
+      glUniform1i(glGetUniformLocation(quadProgram, "uLinearBlend"), 0);
+      linear = false;
+   }
+}
+
+void DrawList::submit(const float *projection, int drawableWidth)
+{
+   // recording order, so a replay batches the commands the same way
+   if (capture)
+      for (const Command &command : commands)
+      {
+         if (command.pipeline == PIPELINE_RECTS)
+         {
+            const RectItem &item = rects[command.item];
+            capture->addRect(command.layer, command.clip, item.x, item.y, item.w, item.h, item.style);
+            continue;
+         }
+         const QuadItem &item = quads[command.item];
+         float color[4] = {item.r, item.g, item.b, item.a};
+         capture->addQuad(command.layer, (uint8_t)command.pipeline, command.texture, command.clip, item.x, item.y,
+                          item.w, item.h, item.u0, item.v0, item.u1, item.v1, color);
+      }
+
+   // layers first, recording order within each
+   order.resize(commands.size());
+   std::iota(order.begin(), order.end(), 0u);
+   std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b)
+                    { return commands[a].layer < commands[b].layer; });
+
+   batches.clear();
+   next.assign(commands.size(), -1);
+   for (uint32_t index : order)
+   {
+      const Command &command = commands[index];
+      const ClipRect &bounds = command.bounds;
+
+      // walk back to a batch in the same state; anything overlapping on the way pins the command after it
+      int target = -1;
+      int oldest = std::max(0, (int)batches.size() - kLookback);
+      for (int b = (int)batches.size() - 1; b >= oldest; b--)
+      {
+         const Batch &batch = batches[b];
+         if (batch.layer != command.layer)
+            break;
+         if (batch.pipeline == command.pipeline && batch.texture == command.texture)
+         {
+            target = b;
+            break;
+         }
+         if (batch.bounds.overlaps(bounds.x0, bounds.y0, bounds.x1, bounds.y1))
+            break;
+      }
+
+      if (target < 0)
+      {
+         batches.push_back({command.layer, command.pipeline, command.texture, bounds, (int)index, (int)index});
+         continue;
+      }
+      Batch &batch = batches[target];
+      next[batch.last] = (int)index;
+      batch.last = (int)index;
+      batch.bounds = {std::min(batch.bounds.x0, bounds.x0), std::min(batch.bounds.y0, bounds.y0),
+                      std::max(batch.bounds.x1, bounds.x1), std::max(batch.bounds.y1, bounds.y1)};
+   }
+
+   // consecutive batches on one pipeline share a begin; the batches themselves
+   // only break the draw where the texture changes
+   draws = 0;
+   int active = -1;
+   ClipRect clip = kUnclipped;
+   replayClips.reset();
+   for (const Batch &batch : batches)
+   {
+      if (batch.pipeline != active)
+      {
+         if (active >= 0)
+            endPipeline((DrawPipeline)active);
+         beginPipeline(batch.pipeline, projection, drawableWidth);
+         active = batch.pipeline;
+      }
+      for (int index = batch.first; index >= 0; index = next[index])
+      {
+         const Command &command = commands[index];
+         if (!sameClip(command.clip, clip))
+         {
+            clip = command.clip;
+            replayClips.reset();
+            if (!sameClip(clip, kUnclipped))
+               replayClips.push(clip.x0, clip.y0, clip.x1 - clip.x0, clip.y1 - clip.y0);
+         }
+         if (command.pipeline == PIPELINE_RECTS)
+         {
+            const RectItem &item = rects[command.item];
+            rectBatch.add(item.x, item.y, item.w, item.h, item.style);
+         }
+         else
+         {
+            const QuadItem &item = quads[command.item];
+            quadBatch.add(command.texture, item.x, item.y, item.w, item.h, item.u0, item.v0, item.u1, item.v1,
+                          item.r, item.g, item.b, item.a);
+         }
+      }
+   }
+   if (active >= 0)
+      endPipeline((DrawPipeline)active);
+
+   submitted = (int)commands.size();
+   lastCulled = culled;
+   culled = 0;
+   commands.clear();
+   rects.clear();
+   quads.clear();
+   layer = 0;
+}
@@ -0,0 +1,130 @@
+#ifndef DRAWLIST_H
+#define DRAWLIST_H
+
+#include "batch.h"
+#include "clip.h"
+#include "rects.h"
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <vector>
+
+class FrameCapture;
+
+// The program and blending a command is drawn with
+enum DrawPipeline
+{
+   PIPELINE_RECTS,  // rect shader, premultiplied
+   PIPELINE_IMAGES, // text shader over premultiplied textures
+   PIPELINE_TEXT    // text shader tinting glyph coverage, blended in linear light where possible
+};
+
+// A frame's rects, images and glyphs, recorded in painter's order and drawn
+// together on submit. Commands are ordered by layer, then each one joins the
+// most recent batch with the same pipeline and texture as long as it doesn't
+// overlap anything recorded in between, so interleaved rects and text stop
+// costing a program switch each. The batches are then replayed through one
+// RectBatch and one QuadBatch, which merge neighbours that still share
+// state. Draw calls follow the number of distinct states on screen rather
+// than the number of widgets.
+//
+// Commands take the clip that is current when they are recorded; those it
+// hides entirely are never recorded, and overlap is tested on what's left.
+class DrawList
+{
+public:
+   static constexpr int kLookback = 16; // batches a command may move back past
+
+   void init(GLuint rectProgram, GLuint quadProgram, VertexFormat format = VERTEX_COMPACT);
+   void release();
+
+   // nullptr records commands unclipped
+   void setClipStack(const ClipStack *stack) { clips = stack; }
+   // Higher layers draw over lower ones whatever the recording order
+   void setLayer(int value) { layer = value; }
+   // While set, submit also hands every command to the capture; nullptr stops it
+   void setCapture(FrameCapture *target) { capture = target; }
+
+   void rect(float x, float y, float w, float h, float r, float g, float b, float a = 1.0f);
+   void rect(float x, float y, float w, float h, const RectStyle &style);
+   void quad(DrawPipeline pipeline, GLuint texture, float x, float y, float w, float h,
+             float u0, float v0, float u1, float v1,
+             float r = 1.0f, float g = 1.0f, float b = 1.0f, float a = 1.0f);
+
+   // Whether the bound draw framebuffer stores sRGB, i.e. can blend in linear
+   // space. Two GL queries; ask once when binding a target, not per frame
+   static bool framebufferIsSRGB();
+   // Set by whoever binds the framebuffer submit draws into; text blends in
+   // linear light only on an sRGB target
+   void setSRGBTarget(bool srgb) { srgbTarget = srgb; }
+
+   // Draw everything into the bound framebuffer, drawableWidth device pixels
+   // wide, and start over. Textures the commands sample have to be uploaded by now.
+   void submit(const float *projection, int drawableWidth);
+
+   // Of the last submit
+   int commandCount() const { return submitted; }
+   int batchCount() const { return (int)batches.size(); }
+   int drawCalls() const { return draws; }
+   int rejected() const { return lastCulled; }
+
+private:
+   struct Command
+   {
+      int layer;
+      DrawPipeline pipeline;
+      GLuint texture;
+      ClipRect clip;
+      ClipRect bounds; // what it can touch, within the clip
+      uint32_t item;   // into rects or quads
+   };
+
+   struct Batch
+   {
+      int layer;
+      DrawPipeline pipeline;
+      GLuint texture;
+      ClipRect bounds;
+      int first, last; // commands chained through next
+   };
+
+   struct QuadItem
+   {
+      float x, y, w, h, u0, v0, u1, v1, r, g, b, a;
+   };
+
+   struct RectItem
+   {
+      float x, y, w, h;
+      RectStyle style;
+   };
+
+   void record(DrawPipeline pipeline, GLuint texture, ClipRect bounds, uint32_t item);
+   void beginPipeline(DrawPipeline pipeline, const float *projection, int drawableWidth);
+   void endPipeline(DrawPipeline pipeline);
+
+   RectBatch rectBatch;
+   QuadBatch quadBatch;
+   ClipStack replayClips;
+   GLuint rectProgram = 0;
+   GLuint quadProgram = 0;
+   const ClipStack *clips = nullptr;
+   FrameCapture *capture = nullptr;
+   int layer = 0;
+   bool linear = false;
+   bool srgbTarget = false;
+
+   std::vector<Command> commands;
+   std::vector<RectItem> rects;
+   std::vector<QuadItem> quads;
+   std::vector<uint32_t> order;
+   std::vector<int> next;
+   std::vector<Batch> batches;
+
+   int submitted = 0;
+   int draws = 0;
+   int culled = 0; // while recording
+   int lastCulled = 0;
+};
+
+#endif
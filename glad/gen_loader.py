@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+"""Generates glad/src/glad.c: a trimmed loader for the engine.
+
+glad's full loader resolves all ~2600 entry points of GL 4.1 and every
+extension at gladLoadGLLoader time. This one keeps glad/include/glad/glad.h
+as it is and defines only:
+
+  - the functions the engine's sources call, resolved by gladLoadGLLoader
+  - the rest of GL 3.3 core, as stubs that resolve themselves on first call
+  - the version flags up to 3.3 and the flags of EXTENSIONS below
+
+Run it (make glad-loader) after the engine starts calling a GL function
+that isn't core 3.3; a core one would only take the slower first call.
+"""
+
+import glob
+import os
+import re
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+HEADER = os.path.join(ROOT, "glad", "include", "glad", "glad.h")
+OUTPUT = os.path.join(ROOT, "glad", "src", "glad.c")
+
+CORE = (3, 3)
+EXTENSIONS = ["GL_ARB_copy_image"]
+# what the loader itself calls
+LOADER = ["glGetString", "glGetStringi", "glGetIntegerv"]
+
+
+def parse_header():
+    """Sections of the header in order: (name, [(function, return type, params)])"""
+    sections = []
+    typedefs = {}
+    typedef = re.compile(r"typedef (.+?) \(APIENTRYP (PFN\w+PROC)\)\((.*)\);$")
+    pointer = re.compile(r"GLAPI (PFN\w+PROC) glad_(\w+);$")
+    with open(HEADER) as header:
+        for line in header:
+            line = line.strip()
+            section = re.match(r"#define (GL_(?:VERSION_\d_\d|[A-Z0-9]+_\w+)) 1$", line)
+            if section:
+                sections.append((section.group(1), []))
+                continue
+            match = typedef.match(line)
+            if match:
+                typedefs[match.group(2)] = (match.group(1), match.group(3))
+                continue
+            match = pointer.match(line)
+            if match and sections:
+                result, params = typedefs[match.group(1)]
+                sections[-1][1].append((match.group(2), match.group(1), result, params))
+    return sections
+
+
+def used_names():
+    """GL functions and GLAD_ flags the engine's sources mention"""
+    names = set()
+    for path in glob.glob(os.path.join(ROOT, "*.cpp")) + glob.glob(os.path.join(ROOT, "*.h")):
+        with open(path, encoding="utf-8", errors="replace") as source:
+            text = source.read()
+        names.update(re.findall(r"\b(?:glad_)?(gl[A-Z]\w*)", text))
+        names.update(re.findall(r"\bGLAD_(GL_\w+)", text))
+    return names
+
+
+def version_of(section):
+    match = re.match(r"GL_VERSION_(\d)_(\d)$", section)
+    return (int(match.group(1)), int(match.group(2))) if match else None
+
+
+def argument_names(params):
+    if params.strip() in ("", "void"):
+        return []
+    # the name is the last identifier of each parameter
+    return [re.findall(r"\w+", param)[-1] for param in params.split(",")]
+
+
+def main():
+    sections = parse_header()
+    used = used_names() | set(LOADER)
+
+    versions = [name for name, _ in sections if version_of(name) and version_of(name) <= CORE]
+    extensions = sorted(set(EXTENSIONS) | {name for name in used if name.startswith("GL_") and not version_of(name)})
+
+    eager, lazy = [], []
+    seen = set()
+    for section, functions in sections:
+        version = version_of(section)
+        core = version is not None and version <= CORE
+        for function in functions:
+            name = function[0]
+            if name in seen:
+                continue
+            if name in used:
+                eager.append(function)
+            elif core or section in extensions:
+                lazy.append(function)
+            else:
+                continue
+            seen.add(name)
+
+    missing = sorted(name for name in used if name.startswith("gl") and name not in seen and
+                     any(name == f[0] for _, functions in sections for f in functions))
+    if missing:
+        sys.exit("not in the header's sections: " + ", ".join(missing))
+
+    out = []
+    emit = out.append
+    emit("/*\n")
+    emit("    Trimmed OpenGL loader generated by glad/gen_loader.py from glad/include/glad/glad.h;\n")
+    emit("    don't edit, run make glad-loader.\n\n")
+    emit("    Resolved by gladLoadGLLoader: %d functions the engine calls\n" % len(eager))
+    emit("    Resolved on first call:       %d more of GL %d.%d core and the extensions\n" % ((len(lazy),) + CORE))
+    emit("    Extensions:                   %s\n" % ", ".join(extensions))
+    emit("*/\n\n")
+    emit("#include <stdio.h>\n#include <string.h>\n#include <glad/glad.h>\n\n")
+    emit("struct gladGLversionStruct GLVersion = { 0, 0 };\n\n")
+    emit("static GLADloadproc lazy_load = NULL;\n\n")
+
+    for name in versions + extensions:
+        emit("int GLAD_%s = 0;\n" % name)
+    emit("\n")
+
+    for name, proc, _, _ in eager:
+        emit("%s glad_%s = NULL;\n" % (proc, name))
+    emit("\n")
+
+    for name, proc, result, params in lazy:
+        args = ", ".join(argument_names(params))
+        emit("static %s APIENTRY glad_lazy_%s(%s) {\n" % (result, name, params if params else "void"))
+        emit("\tglad_%s = (%s)lazy_load(\"%s\");\n" % (name, proc, name))
+        call = "glad_%s(%s);\n" % (name, args)
+        emit("\t" + (call if result == "void" else "return " + call))
+        emit("}\n")
+        emit("%s glad_%s = glad_lazy_%s;\n" % (proc, name, name))
+    emit("\n")
+
+    emit("static int has_ext(const char *ext) {\n")
+    emit("\tGLint count = 0, index;\n")
+    emit("\tglGetIntegerv(GL_NUM_EXTENSIONS, &count);\n")
+    emit("\tfor (index = 0; index < count; index++) {\n")
+    emit("\t\tconst char *name = (const char *)glGetStringi(GL_EXTENSIONS, (GLuint)index);\n")
+    emit("\t\tif (name != NULL && strcmp(name, ext) == 0) return 1;\n")
+    emit("\t}\n")
+    emit("\treturn 0;\n")
+    emit("}\n\n")
+
+    emit("int gladLoadGLLoader(GLADloadproc load) {\n")
+    emit("\tint major = 0, minor = 0;\n")
+    emit("\tconst char *version;\n")
+    emit("\tGLVersion.major = 0; GLVersion.minor = 0;\n")
+    emit("\tglad_glGetString = (PFNGLGETSTRINGPROC)load(\"glGetString\");\n")
+    emit("\tif (glad_glGetString == NULL) return 0;\n")
+    emit("\tversion = (const char *)glGetString(GL_VERSION);\n")
+    emit("\tif (version == NULL || sscanf(version, \"%d.%d\", &major, &minor) != 2) return 0;\n")
+    emit("\tGLVersion.major = major; GLVersion.minor = minor;\n")
+    for name in versions:
+        major, minor = version_of(name)
+        emit("\tGLAD_%s = (major == %d && minor >= %d) || major > %d;\n" % (name, major, minor, major))
+    emit("\tlazy_load = load;\n\n")
+    for name, proc, _, _ in eager:
+        if name != "glGetString":
+            emit("\tglad_%s = (%s)load(\"%s\");\n" % (name, proc, name))
+    emit("\n")
+    emit("\tif (GLAD_GL_VERSION_3_0 && glad_glGetStringi != NULL) {\n")
+    for name in extensions:
+        emit("\t\tGLAD_%s = has_ext(\"%s\");\n" % (name, name))
+    emit("\t}\n")
+    emit("\treturn GLVersion.major >= %d;\n" % CORE[0])
+    emit("}\n")
+
+    with open(OUTPUT, "w", newline="\n") as output:
+        output.writelines(out)
+    print("%s: %d eager, %d lazy, %d extensions" % (os.path.relpath(OUTPUT, ROOT), len(eager), len(lazy), len(extensions)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,600 @@
+#include "glyphs.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#ifdef ENGINE_HARFBUZZ
+#include FT_OUTLINE_H
+#endif
+
+GlyphCache::GlyphCache()
+    : atlas(1024, GL_R8, GL_RED), uploader(nullptr)
+{
+}
+
+GlyphCache::GlyphCache(TextureUploader &uploader)
+    : atlas(1024, GL_R8, GL_RED), uploader(&uploader)
+{
+}
+
+GlyphCache::~GlyphCache()
+{
+   closeFonts();
+}
+
+bool GlyphCache::init(const char *fontPath, int pointSize)
+{
+   this->fontPath = fontPath;
+   this->pointSize = pointSize;
+#ifdef ENGINE_HARFBUZZ
+   if (FT_Init_FreeType(&library) != 0)
+      library = nullptr;
+#endif
+   setScale(1.0f);
+   return font != nullptr;
+}
+
+void GlyphCache::closeFonts()
+{
+   for (FontSize &size : sizes)
+   {
+      if (size.font)
+         TTF_CloseFont(size.font);
+#ifdef ENGINE_HARFBUZZ
+      if (size.face)
+         FT_Done_Face(size.face);
+#endif
+   }
+   sizes.clear();
+   active = 0;
+   font = nullptr;
+#ifdef ENGINE_HARFBUZZ
+   face = nullptr;
+   if (library)
+      FT_Done_FreeType(library);
+   library = nullptr;
+#endif
+}
+
+void GlyphCache::release()
+{
+   glyphs.clear();
+   usage.clear();
+   compacting = -1;
+   atlas.release();
+   closeFonts();
+}
+
+void GlyphCache::setScale(float scale)
+{
+   if (fontPath.empty())
+      return;
+   int pixelSize = std::max(1, (int)std::lround(pointSize * scale));
+   for (size_t i = 0; i < sizes.size(); i++)
+      if (sizes[i].pixelSize == pixelSize)
+      {
+         active = i;
+         font = sizes[i].font;
+#ifdef ENGINE_HARFBUZZ
+         face = sizes[i].face;
+#endif
+         return;
+      }
+
+   // a size the font can't be opened at keeps drawing at the current one
+   FontSize size = {};
+   size.pixelSize = pixelSize;
+   size.scale = (float)pixelSize / pointSize;
+   size.font = TTF_OpenFont(fontPath.c_str(), pixelSize);
+   if (!size.font)
+   {
+      std::cerr << "error loading font " << fontPath << " at " << pixelSize << "px: " << TTF_GetError() << std::endl;
+      return;
+   }
+#ifdef ENGINE_HARFBUZZ
+   if (library && FT_New_Face(library, fontPath.c_str(), 0, &size.face) == 0)
+      FT_Set_Char_Size(size.face, 0, pixelSize * 64, 0, 0);
+   else
+      size.face = nullptr;
+   face = size.face;
+#endif
+   sizes.push_back(size);
+   active = sizes.size() - 1;
+   font = size.font;
+}
+
+// The same glyph from another size, while this frame's rasterization budget is spent
+const Glyph *GlyphCache::standIn(uint32_t key)
+{
+   for (size_t i = 0; i < sizes.size(); i++)
+   {
+      if (i == active)
+         continue;
+      auto found = glyphs.find((uint64_t)i << 40 | key);
+      if (found == glyphs.end())
+         continue;
+      Glyph &glyph = found->second;
+      glyph.lastUsed = frame;
+      if (!glyph.empty && uploader)
+         usage[glyph.region.page].lastUsed = frame;
+      standIns++;
+      return &glyph;
+   }
+   return nullptr;
+}
+
+const Glyph *GlyphCache::get(uint32_t key, int bin)
+{
+   uint64_t slot = (uint64_t)active << 40 | (uint64_t)bin << 32 | key;
+   auto found = glyphs.find(slot);
+   if (found != glyphs.end())
+   {
+      Glyph &glyph = found->second;
+      glyph.lastUsed = frame;
+      if (!glyph.empty && uploader)
+         usage[glyph.region.page].lastUsed = frame;
+      return &glyph;
+   }
+   if (!font)
+      return nullptr;
+
+   // past this frame's budget another size stands in, whatever the offset
+   if (rasterized >= kRasterizePerFrame)
+   {
+      if (const Glyph *other = standIn(key))
+         return other;
+   }
+
+   // blank glyphs look the same at every offset
+   if (bin > 0)
+   {
+      const Glyph *unshifted = get(key, 0);
+      if (unshifted->empty || unshifted->scale != sizes[active].scale)
+         return unshifted;
+      // rasterizing it spent the budget; it stands in for the shifted one until the next frame
+      if (rasterized >= kRasterizePerFrame)
+      {
+         standIns++;
+         return unshifted;
+      }
+   }
+   rasterized++;
+
+   Glyph &glyph = glyphs[slot];
+   glyph = {};
+   glyph.scale = sizes[active].scale;
+   glyph.empty = true;
+   glyph.lastUsed = frame;
+   if (key & kGlyphIndexBit)
+   {
+      rasterizeIndex(glyph, key & ~kGlyphIndexBit, bin);
+      return &glyph;
+   }
+
+   uint32_t codepoint = key;
+   int minX, maxX, minY, maxY, advance;
+   if (TTF_GlyphMetrics32(font, codepoint, &minX, &maxX, &minY, &maxY, &advance) == 0)
+      glyph.advance = advance;
+
+   // 8-bit palettized: with a black background each pixel value is the coverage
+   SDL_Color white = {255, 255, 255, 255}, black = {0, 0, 0, 255};
+   SDL_Surface *surface = TTF_RenderGlyph32_Shaded(font, codepoint, white, black);
+   if (!surface)
+      return &glyph;
+   if (surface->format->BytesPerPixel != 1)
+   {
+      SDL_FreeSurface(surface);
+      return &glyph;
+   }
+
+   // trim to the inked box; the surface covers the whole line height
+   SDL_LockSurface(surface);
+   const unsigned char *pixels = (const unsigned char *)surface->pixels;
+   int left = surface->w, right = 0, top = surface->h, bottom = 0;
+   for (int y = 0; y < surface->h; y++)
+   {
+      const unsigned char *row = pixels + (size_t)y * surface->pitch;
+      for (int x = 0; x < surface->w; x++)
+      {
+         if (!row[x])
+            continue;
+         left = std::min(left, x);
+         right = std::max(right, x + 1);
+         top = std::min(top, y);
+         bottom = std::max(bottom, y + 1);
+      }
+   }
+
+   // the surface starts at the pen unless the glyph hangs left of it
+   const unsigned char *inked = pixels + (size_t)top * surface->pitch + left;
+   int w = right - left, h = bottom - top;
+   if (bin > 0 && w > 0)
+      store(glyph, shift(inked, surface->pitch, w, h, bin), w + 1, w + 1, h, left + std::min(minX, 0), top);
+   else
+      store(glyph, inked, surface->pitch, w, h, left + std::min(minX, 0), top);
+   SDL_UnlockSurface(surface);
+   SDL_FreeSurface(surface);
+   return &glyph;
+}
+
+// SDL_ttf only renders on whole pixels, so its coverage is moved right by
+// resampling; each output pixel mixes a source pixel with its left neighbour
+const unsigned char *GlyphCache::shift(const unsigned char *coverage, int pitch, int w, int h, int bin)
+{
+   int right = bin * 256 / kSubpixelBins, left = 256 - right;
+   shifted.assign((size_t)(w + 1) * h, 0);
+   for (int y = 0; y < h; y++)
+   {
+      const unsigned char *src = coverage + (size_t)y * pitch;
+      unsigned char *dst = shifted.data() + (size_t)y * (w + 1);
+      dst[0] = (unsigned char)((src[0] * left + 128) >> 8);
+      for (int x = 1; x < w; x++)
+         dst[x] = (unsigned char)((src[x] * left + src[x - 1] * right + 128) >> 8);
+      dst[w] = (unsigned char)((src[w - 1] * right + 128) >> 8);
+   }
+   return shifted.data();
+}
+
+// Shaped glyph indices have no codepoint for SDL_ttf, so FreeType renders them
+void GlyphCache::rasterizeIndex(Glyph &glyph, uint32_t index, int bin)
+{
+#ifdef ENGINE_HARFBUZZ
+   // light hinting only snaps vertically, which keeps the subpixel offsets meaningful
+   if (!face || FT_Load_Glyph(face, index, FT_LOAD_TARGET_LIGHT) != 0)
+      return;
+   if (face->glyph->format == FT_GLYPH_FORMAT_OUTLINE)
+      FT_Outline_Translate(&face->glyph->outline, bin * 64 / kSubpixelBins, 0);
+   if (FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL) != 0)
+      return;
+   const FT_Bitmap &bitmap = face->glyph->bitmap;
+   if (bitmap.pixel_mode != FT_PIXEL_MODE_GRAY || bitmap.pitch < 0)
+      return;
+   // offsets are from the line top like SDL_ttf's, which puts the baseline at the ascent
+   store(glyph, bitmap.buffer, bitmap.pitch, (int)bitmap.width, (int)bitmap.rows,
+         face->glyph->bitmap_left, TTF_FontAscent(font) - face->glyph->bitmap_top);
+#else
+   (void)glyph;
+   (void)index;
+   (void)bin;
+#endif
+}
+
+// Keep w x h coverage bytes for a glyph: in memory without an uploader, otherwise in the atlas
+void GlyphCache::store(Glyph &glyph, const unsigned char *coverage, int pitch, int w, int h, int offsetX, int offsetY)
+{
+   if (w <= 0 || h <= 0)
+      return;
+   if (!uploader)
+   {
+      glyph.region = {0, 0, 0, w, h, 0.0f, 0.0f, 1.0f, 1.0f};
+      glyph.coverage.resize((size_t)w * h);
+      for (int y = 0; y < h; y++)
+         memcpy(glyph.coverage.data() + (size_t)y * w, coverage + (size_t)y * pitch, w);
+   }
+   else if (allocate(w, h, glyph.region))
+   {
+      uploader->upload(atlas.texture(glyph.region.page), glyph.region.x, glyph.region.y, w, h, GL_RED, coverage, pitch);
+      usage.resize(atlas.pageCount());
+      usage[glyph.region.page].lastUsed = frame;
+      usage[glyph.region.page].liveArea += (long long)w * h;
+   }
+   else
+      return;
+
+   glyph.offsetX = offsetX;
+   glyph.offsetY = offsetY;
+   glyph.empty = false;
+}
+
+// Color of the span holding a byte, spans being sorted by start
+static SDL_Color colorAt(const std::vector<TokenSpan> *spans, SDL_Color (*spanColor)(TokenKind), uint32_t offset, SDL_Color color)
+{
+   if (!spans || !spanColor)
+      return color;
+   auto after = std::upper_bound(spans->begin(), spans->end(), offset, [](uint32_t value, const TokenSpan &span)
+                                 { return value < span.start; });
+   if (after == spans->begin())
+      return color;
+   const TokenSpan &span = *(after - 1);
+   return offset < span.start + span.length ? spanColor(span.kind) : color;
+}
+
+// The glyph for a pen position: whole device pixels place it, the fraction picks the variant
+const Glyph *GlyphCache::place(uint32_t key, float penX, float lineY, SDL_Color color, std::vector<PlacedGlyph> &out)
+{
+   float scale = sizes[active].scale;
+   float device = penX * scale;
+   float pixel = std::floor(device);
+   int bin = (int)std::lround((device - pixel) * kSubpixelBins);
+   if (bin == kSubpixelBins)
+   {
+      pixel += 1.0f;
+      bin = 0;
+   }
+   const Glyph *glyph = get(key, bin);
+   if (!glyph->empty)
+   {
+      // a stand-in from another size is stretched to this one
+      float ratio = scale / glyph->scale;
+      out.push_back({glyph, (pixel + glyph->offsetX * ratio) / scale,
+                     (std::floor(lineY * scale + 0.5f) + glyph->offsetY * ratio) / scale,
+                     glyph->region.w / glyph->scale, glyph->region.h / glyph->scale, color});
+   }
+   return glyph;
+}
+
+float GlyphCache::layout(const std::string &text, float x, float y, SDL_Color color, const std::vector<TokenSpan> *spans,
+                         SDL_Color (*spanColor)(TokenKind), std::vector<PlacedGlyph> &out)
+{
+   if (!font)
+      return 0.0f;
+
+   if (shaping)
+   {
+      std::shared_ptr<const ShapedRun> run = shaping->get(text);
+      for (const ShapedGlyph &shaped : run->glyphs)
+         place(shaped.glyph, x + shaped.x, y + shaped.y, colorAt(spans, spanColor, shaped.cluster, color), out);
+      return run->width;
+   }
+
+   decodeText(text, text.size(), codepoints, offsets);
+   float pen = x;
+   for (size_t i = 0; i < codepoints.size(); i++)
+   {
+      if (i > 0)
+         pen += TTF_GetFontKerningSizeGlyphs32(font, codepoints[i - 1], codepoints[i]) / scale();
+      const Glyph *glyph = place(codepoints[i], pen, y, colorAt(spans, spanColor, offsets[i], color), out);
+      pen += glyph->advance / glyph->scale;
+   }
+   return pen - x;
+}
+
+float GlyphCache::draw(DrawList &list, const std::string &text, float x, float y, SDL_Color color,
+                       const std::vector<TokenSpan> *spans, SDL_Color (*spanColor)(TokenKind))
+{
+   placed.clear();
+   float width = layout(text, x, y, color, spans, spanColor, placed);
+   for (const PlacedGlyph &quad : placed)
+   {
+      const AtlasRegion &region = quad.glyph->region;
+      list.quad(PIPELINE_TEXT, atlas.texture(region.page), quad.x, quad.y, quad.w, quad.h,
+                region.u0, region.v0, region.u1, region.v1,
+                quad.color.r / 255.0f, quad.color.g / 255.0f, quad.color.b / 255.0f, quad.color.a / 255.0f);
+   }
+   return width;
+}
+
+float GlyphCache::measure(const std::string &text, size_t length)
+{
+   if (!font)
+      return 0.0f;
+
+   if (shaping)
+   {
+      // the left edge of the first glyph at or past the byte; shaped runs can reorder and merge clusters
+      std::shared_ptr<const ShapedRun> run = shaping->get(text);
+      if (length >= text.size())
+         return run->width;
+      float x = run->rightToLeft ? 0.0f : run->width;
+      for (const ShapedGlyph &shaped : run->glyphs)
+         if (shaped.cluster >= length)
+            x = run->rightToLeft ? std::max(x, shaped.x) : std::min(x, shaped.x);
+      return x;
+   }
+
+   decodeText(text, length, codepoints, offsets);
+   float width = 0.0f;
+   for (size_t i = 0; i < codepoints.size(); i++)
+   {
+      if (i > 0)
+         width += TTF_GetFontKerningSizeGlyphs32(font, codepoints[i - 1], codepoints[i]) / scale();
+      const Glyph *glyph = get(codepoints[i]);
+      width += glyph->advance / glyph->scale;
+   }
+   return width;
+}
+
+// -------- Budget --------
+
+void GlyphCache::setBudget(size_t bytes)
+{
+   budgetBytes = bytes;
+   budgetPages = bytes ? std::max(1, (int)(bytes / atlas.pageBytes())) : 0;
+   atlas.setPageLimit(budgetPages);
+}
+
+GlyphCacheStats GlyphCache::stats() const
+{
+   GlyphCacheStats stats = {};
+   stats.glyphs = glyphs.size();
+   stats.pages = atlas.livePages();
+   stats.bytes = stats.pages * atlas.pageBytes();
+   stats.budget = budgetBytes;
+   long long live = 0;
+   for (size_t page = 0; page < usage.size(); page++)
+      if (atlas.isLive((int)page))
+         live += usage[page].liveArea;
+   long long pageArea = (long long)atlas.pageSize() * atlas.pageSize();
+   stats.occupancy = stats.pages ? (double)live / (pageArea * stats.pages) : 0.0;
+   stats.pagesEvicted = pagesEvicted;
+   stats.glyphsEvicted = glyphsEvicted;
+   stats.glyphsMoved = glyphsMoved;
+   stats.pagesCompacted = pagesCompacted;
+   return stats;
+}
+
+bool GlyphCache::allocate(int w, int h, AtlasRegion &region)
+{
+   if (atlas.add(w, h, region))
+      return true;
+
+   // at the budget: recycle the least recently used page
+   int victim = leastRecentlyUsedPage();
+   if (victim >= 0)
+   {
+      evictPage(victim);
+      atlas.clearPage(victim);
+      if (atlas.addToPage(victim, w, h, region))
+         return true;
+   }
+
+   // every page is on screen this frame: go over budget rather than drop text, endFrame trims it back
+   atlas.setPageLimit(0);
+   bool added = atlas.add(w, h, region);
+   atlas.setPageLimit(budgetPages);
+   return added;
+}
+
+// Pages not drawn from in the current frame, oldest first; -1 if there are none
+int GlyphCache::leastRecentlyUsedPage() const
+{
+   int oldest = -1;
+   for (size_t page = 0; page < usage.size(); page++)
+   {
+      if (!atlas.isLive((int)page) || usage[page].lastUsed >= frame || (int)page == compacting || (int)page == compactTarget)
+         continue;
+      if (oldest < 0 || usage[page].lastUsed < usage[oldest].lastUsed)
+         oldest = (int)page;
+   }
+   return oldest;
+}
+
+void GlyphCache::evictPage(int page)
+{
+   for (auto entry = glyphs.begin(); entry != glyphs.end();)
+   {
+      if (!entry->second.empty && entry->second.region.page == page)
+      {
+         entry = glyphs.erase(entry);
+         glyphsEvicted++;
+      }
+      else
+         ++entry;
+   }
+   usage[page] = PageUsage();
+   pagesEvicted++;
+}
+
+// Idle glyphs leave holes that compaction later closes
+void GlyphCache::expireGlyphs()
+{
+   for (auto entry = glyphs.begin(); entry != glyphs.end();)
+   {
+      Glyph &glyph = entry->second;
+      if (glyph.lastUsed + kGlyphExpiryFrames < frame)
+      {
+         if (!glyph.empty)
+            usage[glyph.region.page].liveArea -= (long long)glyph.region.w * glyph.region.h;
+         entry = glyphs.erase(entry);
+         glyphsEvicted++;
+      }
+      else
+         ++entry;
+   }
+}
+
+void GlyphCache::compact()
+{
+   long long pageArea = (long long)atlas.pageSize() * atlas.pageSize();
+   if (compactTarget >= 0 && !atlas.isLive(compactTarget))
+      compactTarget = -1;
+   if (compacting < 0)
+   {
+      int live = atlas.livePages();
+      long long total = 0;
+      for (size_t page = 0; page < usage.size(); page++)
+         if (atlas.isLive((int)page))
+         {
+            total += usage[page].liveArea;
+            if ((int)page != compactTarget && (compacting < 0 || usage[page].liveArea < usage[compacting].liveArea))
+               compacting = (int)page;
+         }
+      // the fresh page has to fit in the budget; at the limit the LRU recycles pages instead
+      bool room = atlas.pageLimit() == 0 || compactTarget >= 0 || live < atlas.pageLimit();
+      if (!room || live < 2 || frame < compactAfter || total > (long long)((live - 1) * pageArea * kCompactFill))
+      {
+         compacting = -1;
+         return;
+      }
+      if (compactTarget < 0)
+      {
+         compactTarget = atlas.addPage();
+         usage.resize(atlas.pageCount());
+         usage[compactTarget] = PageUsage();
+      }
+   }
+
+   // the fresh page first, then the fullest others
+   std::vector<int> targets;
+   for (size_t page = 0; page < usage.size(); page++)
+      if (atlas.isLive((int)page) && (int)page != compacting && (int)page != compactTarget)
+         targets.push_back((int)page);
+   std::sort(targets.begin(), targets.end(), [this](int a, int b)
+             { return usage[a].liveArea > usage[b].liveArea; });
+   targets.insert(targets.begin(), compactTarget);
+
+   int moved = 0;
+   for (auto &entry : glyphs)
+   {
+      Glyph &glyph = entry.second;
+      if (glyph.empty || glyph.region.page != compacting)
+         continue;
+      if (moved == kMovesPerFrame)
+         return;
+
+      AtlasRegion target;
+      bool placed = false;
+      for (int page : targets)
+         if ((placed = atlas.addToPage(page, glyph.region.w, glyph.region.h, target)))
+            break;
+      if (!placed)
+      {
+         // the fresh page filled up; another one starts on the next pass
+         compacting = compactTarget = -1;
+         compactAfter = frame + kSweepInterval;
+         return;
+      }
+
+      atlas.copy(glyph.region, target);
+      long long area = (long long)glyph.region.w * glyph.region.h;
+      usage[compacting].liveArea -= area;
+      usage[target.page].liveArea += area;
+      usage[target.page].lastUsed = std::max(usage[target.page].lastUsed, glyph.lastUsed);
+      glyph.region = target;
+      glyphsMoved++;
+      moved++;
+   }
+
+   atlas.freePage(compacting);
+   usage[compacting] = PageUsage();
+   pagesCompacted++;
+   compacting = -1;
+}
+
+void GlyphCache::endFrame()
+{
+   if (uploader && font)
+   {
+      // glyph copies read texels that have to be uploaded first
+      uploader->flush();
+
+      // a frame that needed every page may have gone over; give back the stalest
+      while (budgetPages > 0 && atlas.livePages() > budgetPages)
+      {
+         int victim = leastRecentlyUsedPage();
+         if (victim < 0)
+            break;
+         evictPage(victim);
+         atlas.freePage(victim);
+      }
+
+      if (frame % kSweepInterval == 0)
+         expireGlyphs();
+      compact();
+   }
+   rasterized = 0;
+   standIns = 0;
+   frame++;
+}
@@ -0,0 +1,188 @@
+#ifndef GLYPHS_H
+#define GLYPHS_H
+
+#include "atlas.h"
+#include "drawlist.h"
+#include "highlight.h"
+#include "shape.h"
+#include "upload.h"
+
+#include <SDL2/SDL_ttf.h>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct Glyph
+{
+   AtlasRegion region;
+   int offsetX, offsetY; // top-left of the coverage box from the pen position and line top
+   int advance;
+   float scale;          // of the font size it was rasterized at; offsets, advance and region are in its pixels
+   bool empty;           // nothing to draw (spaces)
+   uint64_t lastUsed;    // frame stamp
+   std::vector<unsigned char> coverage; // w x h, kept only by caches without an uploader
+};
+
+struct PlacedGlyph
+{
+   const Glyph *glyph;
+   float x, y; // top-left of the coverage box
+   float w, h; // in layout units; the coverage box over the glyph's scale
+   SDL_Color color;
+};
+
+struct GlyphCacheStats
+{
+   size_t glyphs;       // rasterized and resident
+   int pages;
+   size_t bytes;        // texture memory of the live pages
+   size_t budget;
+   double occupancy;    // live glyph texels over page texels
+   uint64_t pagesEvicted;
+   uint64_t glyphsEvicted;
+   uint64_t glyphsMoved;
+   uint64_t pagesCompacted;
+};
+
+// Glyphs rasterized once into single-channel GL_R8 atlas pages. SDL_ttf's
+// shaded renderer already produces one coverage byte per pixel, so rows go
+// from its surface straight to the uploader with no 32-bit conversion. The
+// pages are swizzled to (1, 1, 1, coverage), which lets the regular text
+// shader tint glyphs with the vertex color. Without an uploader nothing
+// touches GL and the coverage stays in memory for the software renderer.
+//
+// Atlas memory is held to a budget. Every lookup stamps the glyph and its page
+// with the current frame; when a new page would exceed the budget the least
+// recently used page is recycled whole, and glyphs idle for kGlyphExpiryFrames
+// are dropped one by one. Once the survivors would fit in fewer pages, endFrame
+// repacks them kMovesPerFrame at a time on the GL thread: glyphs are copied on
+// the GPU from the sparsest page into a fresh one, and each drained page is
+// freed. The fresh page counts against the budget, so a cache already at its
+// page limit leaves the repacking to the LRU.
+//
+// Pen positions keep their fractional part. A glyph is placed on the pixel at
+// or left of its pen and the remainder, rounded to one of kSubpixelBins
+// steps, selects a variant rasterized that far right. Variants are separate
+// cache entries made on first use, so steady text still hits every frame.
+//
+// Layout is in window units and the font is opened again for each display
+// scale at the effective pixel size, so HiDPI text is rasterized at device
+// resolution and placed on device pixels. Sizes share the atlas and the keys
+// carry the size; after a move to another monitor, glyphs of the old size age
+// out through the LRU while the new size fills in. At most
+// kRasterizePerFrame misses are rasterized per frame while another size can
+// stand in, scaled, for the rest, or the unshifted variant for a subpixel
+// one, which spreads the refill over a few frames.
+class GlyphCache
+{
+public:
+   GlyphCache();
+   explicit GlyphCache(TextureUploader &uploader);
+   ~GlyphCache();
+   GlyphCache(const GlyphCache &) = delete;
+   GlyphCache &operator=(const GlyphCache &) = delete;
+
+   static constexpr uint64_t kGlyphExpiryFrames = 3600;
+   static constexpr uint64_t kSweepInterval = 120;
+   static constexpr int kMovesPerFrame = 64;
+   static constexpr double kCompactFill = 0.5; // drain a page once everything fits in one page fewer at this fill
+   static constexpr int kSubpixelBins = 4;      // horizontal positions per pixel
+   static constexpr int kRasterizePerFrame = 48; // misses per frame while a stand-in exists
+
+   bool init(const char *fontPath, int pointSize);
+   void release();
+   // Device pixels per layout unit; opens the font at the new size on first use
+   void setScale(float scale);
+   float scale() const { return sizes.empty() ? 1.0f : sizes[active].scale; }
+   bool isOpen() const { return font != nullptr; }
+
+   // Bytes of atlas texture to stay within; 0 means unlimited
+   void setBudget(size_t bytes);
+   // Advance the frame stamp, trim to the budget and do a slice of compaction; GL thread only
+   void endFrame();
+   // Some text this frame was drawn with glyphs of another scale; draw again to finish the refill
+   bool refilling() const { return standIns > 0; }
+   GlyphCacheStats stats() const;
+
+   // Lay text out from shaped runs instead of codepoint by codepoint
+   void setShaping(ShapeCache *cache) { shaping = cache; }
+
+   // Keyed by codepoint, or glyph index with kGlyphIndexBit set, shifted right
+   // by bin / kSubpixelBins of a pixel, at the current scale. Rasterized on
+   // first use, or possibly another scale's while the refill is throttled;
+   // nullptr only when no font is open
+   const Glyph *get(uint32_t key, int bin = 0);
+
+   // Position and color every visible glyph; spans recolor byte ranges. Returns the advance width
+   float layout(const std::string &text, float x, float y, SDL_Color color, const std::vector<TokenSpan> *spans,
+                SDL_Color (*spanColor)(TokenKind), std::vector<PlacedGlyph> &out);
+   // Record one quad per visible glyph
+   float draw(DrawList &list, const std::string &text, float x, float y, SDL_Color color,
+              const std::vector<TokenSpan> *spans = nullptr, SDL_Color (*spanColor)(TokenKind) = nullptr);
+   // Advance width of the first length bytes
+   float measure(const std::string &text, size_t length = std::string::npos);
+
+private:
+   struct FontSize
+   {
+      int pixelSize;
+      float scale;
+      TTF_Font *font;
+#ifdef ENGINE_HARFBUZZ
+      FT_Face face;
+#endif
+   };
+
+   struct PageUsage
+   {
+      uint64_t lastUsed = 0;
+      long long liveArea = 0;
+   };
+
+   void closeFonts();
+   const Glyph *standIn(uint32_t key);
+   void rasterizeIndex(Glyph &glyph, uint32_t index, int bin);
+   const unsigned char *shift(const unsigned char *coverage, int pitch, int w, int h, int bin);
+   const Glyph *place(uint32_t key, float penX, float lineY, SDL_Color color, std::vector<PlacedGlyph> &out);
+   void store(Glyph &glyph, const unsigned char *coverage, int pitch, int w, int h, int offsetX, int offsetY);
+   bool allocate(int w, int h, AtlasRegion &region);
+   int leastRecentlyUsedPage() const;
+   void evictPage(int page);
+   void expireGlyphs();
+   void compact();
+
+   std::string fontPath;
+   int pointSize = 0;
+   std::vector<FontSize> sizes;
+   size_t active = 0;
+   TTF_Font *font = nullptr; // the active size's
+   int rasterized = 0;       // this frame
+   int standIns = 0;         // this frame
+#ifdef ENGINE_HARFBUZZ
+   FT_Library library = nullptr;
+   FT_Face face = nullptr; // for glyph indices; the shaper has its own
+#endif
+   ShapeCache *shaping = nullptr;
+   TextureAtlas atlas;
+   TextureUploader *uploader;
+   std::unordered_map<uint64_t, Glyph> glyphs; // key | bin << 32 | size << 40
+   std::vector<unsigned char> shifted;
+   std::vector<uint32_t> codepoints;
+   std::vector<uint32_t> offsets;
+   std::vector<PlacedGlyph> placed;
+
+   std::vector<PageUsage> usage;
+   uint64_t frame = 1;
+   size_t budgetBytes = 0;
+   int budgetPages = 0;
+   int compacting = -1;  // page being drained
+   int compactTarget = -1; // page receiving its glyphs
+   uint64_t compactAfter = 0;
+   uint64_t pagesEvicted = 0;
+   uint64_t glyphsEvicted = 0;
+   uint64_t glyphsMoved = 0;
+   uint64_t pagesCompacted = 0;
+};
+
+#endif
@@ -0,0 +1,238 @@
+#include "golden.h"
+
+#include <glad/glad.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+static const int kWarmupFrames = 3;
+static const int kTimedFrames = 30;
+static const float kColorThreshold = 0.1f;  // per-pixel YIQ distance, 0..1
+static const double kMaxMismatched = 0.001; // fraction of pixels allowed past the threshold
+
+// -------- Draw call counting --------
+
+static int drawCalls = 0;
+static PFNGLDRAWARRAYSPROC realDrawArrays = nullptr;
+static PFNGLDRAWELEMENTSPROC realDrawElements = nullptr;
+static PFNGLDRAWARRAYSINSTANCEDPROC realDrawArraysInstanced = nullptr;
+
+static void APIENTRY countDrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+   drawCalls++;
+   realDrawArrays(mode, first, count);
+}
+
+static void APIENTRY countDrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices)
+{
+   drawCalls++;
+   realDrawElements(mode, count, type, indices);
+}
+
+static void APIENTRY countDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances)
+{
+   drawCalls++;
+   realDrawArraysInstanced(mode, first, count, instances);
+}
+
+// -------- Comparison --------
+
+// Squared YIQ difference of two RGBA8 pixels, as used by pixelmatch
+static float colorDelta(const unsigned char *a, const unsigned char *b)
+{
+   float dr = (float)a[0] - b[0], dg = (float)a[1] - b[1], db = (float)a[2] - b[2];
+   float y = dr * 0.29889531f + dg * 0.58662247f + db * 0.11448223f;
+   float i = dr * 0.59597799f - dg * 0.27417610f - db * 0.32180189f;
+   float q = dr * 0.21147017f - dg * 0.52261711f + db * 0.31114694f;
+   return 0.5053f * y * y + 0.299f * i * i + 0.1957f * q * q;
+}
+
+static const long long kNoReference = -1;   // missing or unreadable
+static const long long kReferenceSize = -2; // a different size than the scene
+
+// Pixels of two RGBA8 images past the threshold
+static long long countMismatched(const unsigned char *expected, size_t expectedPitch, const unsigned char *actual,
+                                 int width, int height)
+{
+   const float maxDelta = 35215.0f * kColorThreshold * kColorThreshold;
+   long long mismatched = 0;
+   for (int y = 0; y < height; y++)
+   {
+      const unsigned char *expectedRow = expected + (size_t)y * expectedPitch;
+      const unsigned char *actualRow = actual + (size_t)y * width * 4;
+      for (int x = 0; x < width; x++)
+         if (colorDelta(expectedRow + x * 4, actualRow + x * 4) > maxDelta)
+            mismatched++;
+   }
+   return mismatched;
+}
+
+// Pixels past the threshold, or why the reference can't be used
+static long long countMismatched(const std::vector<unsigned char> &pixels, int width, int height, const std::string &path)
+{
+   SDL_Surface *loaded = IMG_Load(path.c_str());
+   if (!loaded)
+      return kNoReference;
+   SDL_Surface *reference = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ABGR8888, 0);
+   SDL_FreeSurface(loaded);
+   if (!reference)
+      return kNoReference;
+   if (reference->w != width || reference->h != height)
+   {
+      SDL_FreeSurface(reference);
+      return kReferenceSize;
+   }
+
+   SDL_LockSurface(reference);
+   long long mismatched = countMismatched((const unsigned char *)reference->pixels, reference->pitch, pixels.data(),
+                                          width, height);
+   SDL_UnlockSurface(reference);
+   SDL_FreeSurface(reference);
+   return mismatched;
+}
+
+static bool writePng(std::vector<unsigned char> &pixels, int width, int height, const std::string &path)
+{
+   SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom(pixels.data(), width, height, 32, width * 4,
+                                                             SDL_PIXELFORMAT_ABGR8888);
+   bool written = surface && IMG_SavePNG(surface, path.c_str()) == 0;
+   if (!written)
+      std::cerr << "Failed to write " << path << ": " << SDL_GetError() << std::endl;
+   if (surface)
+      SDL_FreeSurface(surface);
+   return written;
+}
+
+// -------- Runner --------
+
+int runGoldenScenes(const std::vector<GoldenScene> &scenes, const char *directory, bool update,
+                    const std::function<void(bool srgb)> &targetBound)
+{
+   realDrawArrays = glad_glDrawArrays;
+   realDrawElements = glad_glDrawElements;
+   realDrawArraysInstanced = glad_glDrawArraysInstanced;
+   glad_glDrawArrays = countDrawArrays;
+   glad_glDrawElements = countDrawElements;
+   glad_glDrawArraysInstanced = countDrawArraysInstanced;
+
+   int failures = 0;
+   printf("%-16s %9s %9s %7s %7s %10s  %s\n", "scene", "ms", "budget", "draws", "budget", "mismatched", "result");
+   for (const GoldenScene &scene : scenes)
+   {
+      GLuint framebuffer, color;
+      glGenFramebuffers(1, &framebuffer);
+      glGenRenderbuffers(1, &color);
+      glBindRenderbuffer(GL_RENDERBUFFER, color);
+      // sRGB like the window's framebuffer, so text blends the same way it does on screen,
+      // unless the scene is checked against a renderer that blends the stored values
+      glRenderbufferStorage(GL_RENDERBUFFER, scene.expected ? GL_RGBA8 : GL_SRGB8_ALPHA8, scene.width, scene.height);
+      glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+      glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+      if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+      {
+         std::cerr << "Golden framebuffer incomplete for " << scene.name << std::endl;
+         glBindFramebuffer(GL_FRAMEBUFFER, 0);
+         glDeleteRenderbuffers(1, &color);
+         glDeleteFramebuffers(1, &framebuffer);
+         failures++;
+         continue;
+      }
+      glViewport(0, 0, scene.width, scene.height);
+      targetBound(!scene.expected);
+
+      // warm-up frames fill glyph atlases and upload rings, so timing sees steady state
+      for (int i = 0; i < kWarmupFrames; i++)
+         scene.draw(scene.width, scene.height);
+      glFinish();
+
+      std::vector<double> times;
+      for (int i = 0; i < (scene.timedFrames > 0 ? scene.timedFrames : kTimedFrames); i++)
+      {
+         drawCalls = 0;
+         Uint64 start = SDL_GetPerformanceCounter();
+         scene.draw(scene.width, scene.height);
+         times.push_back((SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency());
+         // GPU time stays out of the measurement
+         glFinish();
+      }
+      std::sort(times.begin(), times.end());
+      double median = times[times.size() / 2];
+      int frameDraws = drawCalls;
+
+      // bottom row first from GL; flip to match the PNG
+      std::vector<unsigned char> pixels((size_t)scene.width * scene.height * 4);
+      std::vector<unsigned char> row((size_t)scene.width * 4);
+      glPixelStorei(GL_PACK_ALIGNMENT, 1);
+      glReadPixels(0, 0, scene.width, scene.height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+      for (int y = 0; y < scene.height / 2; y++)
+      {
+         unsigned char *top = pixels.data() + (size_t)y * row.size();
+         unsigned char *bottom = pixels.data() + (size_t)(scene.height - 1 - y) * row.size();
+         std::copy(top, top + row.size(), row.data());
+         std::copy(bottom, bottom + row.size(), top);
+         std::copy(row.data(), row.data() + row.size(), bottom);
+      }
+
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
+      glDeleteRenderbuffers(1, &color);
+      glDeleteFramebuffers(1, &framebuffer);
+
+      std::string path = std::string(directory) + "/" + scene.name + ".png";
+      long long mismatched = kNoReference;
+      if (scene.expected)
+      {
+         std::vector<unsigned char> expected;
+         scene.expected(scene.width, scene.height, expected);
+         mismatched = expected.size() == pixels.size()
+                          ? countMismatched(expected.data(), (size_t)scene.width * 4, pixels.data(), scene.width, scene.height)
+                          : kReferenceSize;
+      }
+      // references are only ever written on request, so a lost one can't quietly pass
+      else if (!update)
+         mismatched = countMismatched(pixels, scene.width, scene.height, path);
+      const char *result = "ok";
+      bool failed = false;
+      if (update && !scene.expected)
+      {
+         result = writePng(pixels, scene.width, scene.height, path) ? "written" : "FAILED (write)";
+         failed = result[0] == 'F';
+      }
+      else if (mismatched == kNoReference)
+      {
+         result = "FAILED (no reference)";
+         failed = true;
+      }
+      else if (mismatched == kReferenceSize)
+      {
+         result = "FAILED (reference size)";
+         failed = true;
+      }
+      else if (mismatched > (long long)(kMaxMismatched * scene.width * scene.height))
+      {
+         result = "FAILED (pixels)";
+         failed = true;
+      }
+      if (!failed && median > scene.frameBudgetMs)
+      {
+         result = "FAILED (time)";
+         failed = true;
+      }
+      if (!failed && frameDraws > scene.drawCallBudget)
+      {
+         result = "FAILED (draws)";
+         failed = true;
+      }
+      failures += failed;
+
+      printf("%-16s %9.3f %9.3f %7d %7d %10lld  %s\n", scene.name, median, scene.frameBudgetMs, frameDraws,
+             scene.drawCallBudget, std::max(mismatched, 0LL), result);
+   }
+
+   glad_glDrawArrays = realDrawArrays;
+   glad_glDrawElements = realDrawElements;
+   glad_glDrawArraysInstanced = realDrawArraysInstanced;
+   return failures;
+}
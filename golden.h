@@ -0,0 +1,36 @@
+#ifndef GOLDEN_H
+#define GOLDEN_H
+
+#include <functional>
+#include <vector>
+
+struct GoldenScene
+{
+   const char *name;
+   int width, height;
+   double frameBudgetMs; // median CPU time to issue one frame
+   int drawCallBudget;
+   // Draws one complete frame into the bound framebuffer
+   std::function<void(int width, int height)> draw;
+   int timedFrames = 0; // 0 for the runner's default
+   // When set, fills in the pixels the frame should match (RGBA8, top row
+   // first) in place of a reference image; the frame is then drawn into a
+   // linear RGBA8 framebuffer so nothing blends in linear light
+   std::function<void(int width, int height, std::vector<unsigned char> &pixels)> expected = nullptr;
+};
+
+// Golden-image regression run. Each scene is drawn into an offscreen FBO,
+// warmed up, timed over a number of frames, then read back and compared with
+// <directory>/<name>.png using a perceptual (YIQ) color distance, so driver
+// differences in antialiasing don't fail it but visible changes do. Draw
+// calls are counted by wrapping the loader's glDraw* entry points. A missing,
+// unreadable or differently sized reference fails its scene; with update set,
+// every reference is written instead of compared. Scenes with an expected
+// callback are compared with what it produces, using the same distance.
+// targetBound is called once each scene's framebuffer is bound, with whether
+// it stores sRGB, so the renderer needn't query it.
+// Needs a current GL context; returns the number of failed scenes.
+int runGoldenScenes(const std::vector<GoldenScene> &scenes, const char *directory, bool update,
+                    const std::function<void(bool srgb)> &targetBound);
+
+#endif
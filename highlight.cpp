@@ -0,0 +1,390 @@
+#include "highlight.h"
+#include "document.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+// -------- Lexer --------
+
+// Sorted for binary search
+static const char *kKeywords[] = {
+    "auto", "bool", "break", "case", "catch", "char", "class", "const", "constexpr", "continue",
+    "default", "delete", "do", "double", "else", "enum", "explicit", "extern", "false", "float",
+    "for", "friend", "goto", "if", "inline", "int", "long", "mutable", "namespace", "new",
+    "nullptr", "operator", "private", "protected", "public", "return", "short", "signed", "sizeof",
+    "static", "struct", "switch", "template", "this", "throw", "true", "try", "typedef", "typename",
+    "union", "unsigned", "using", "virtual", "void", "volatile", "while"};
+
+static bool isKeyword(const char *word, size_t length)
+{
+   size_t lo = 0, hi = sizeof(kKeywords) / sizeof(kKeywords[0]);
+   while (lo < hi)
+   {
+      size_t mid = (lo + hi) / 2;
+      int cmp = strncmp(kKeywords[mid], word, length);
+      if (cmp == 0)
+         cmp = kKeywords[mid][length] ? 1 : 0;
+      if (cmp == 0)
+         return true;
+      if (cmp < 0)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return false;
+}
+
+// Scan a quoted literal from just after its opening quote; open is set if it runs off the line
+static size_t scanQuoted(const std::string &line, size_t i, char quote, bool &open)
+{
+   open = false;
+   while (i < line.size())
+   {
+      if (line[i] == '\\')
+         i += 2;
+      else if (line[i++] == quote)
+         return i;
+   }
+   open = true;
+   return line.size();
+}
+
+LexState lexLine(const std::string &line, LexState state, std::vector<TokenSpan> &spans)
+{
+   spans.clear();
+   size_t n = line.size();
+   size_t i = 0;
+   auto push = [&spans](size_t start, size_t end, TokenKind kind)
+   {
+      if (end > start)
+         spans.push_back({(uint32_t)start, (uint32_t)(end - start), kind});
+   };
+
+   if (state == LEX_BLOCK_COMMENT)
+   {
+      size_t close = line.find("*/");
+      if (close == std::string::npos)
+      {
+         push(0, n, TOKEN_COMMENT);
+         return LEX_BLOCK_COMMENT;
+      }
+      i = close + 2;
+      push(0, i, TOKEN_COMMENT);
+   }
+   else if (state == LEX_STRING)
+   {
+      bool open;
+      i = scanQuoted(line, 0, '"', open);
+      push(0, i, TOKEN_STRING);
+      if (open && n > 0 && line[n - 1] == '\\')
+         return LEX_STRING;
+   }
+
+   size_t firstNonSpace = line.find_first_not_of(" \t");
+   while (i < n)
+   {
+      char c = line[i];
+      char next = i + 1 < n ? line[i + 1] : '\0';
+
+      if (c == '/' && next == '/')
+      {
+         push(i, n, TOKEN_COMMENT);
+         return LEX_NORMAL;
+      }
+      if (c == '/' && next == '*')
+      {
+         size_t close = line.find("*/", i + 2);
+         if (close == std::string::npos)
+         {
+            push(i, n, TOKEN_COMMENT);
+            return LEX_BLOCK_COMMENT;
+         }
+         push(i, close + 2, TOKEN_COMMENT);
+         i = close + 2;
+      }
+      else if (c == '"' || c == '\'')
+      {
+         bool open;
+         size_t end = scanQuoted(line, i + 1, c, open);
+         push(i, end, TOKEN_STRING);
+         if (open && c == '"' && line[n - 1] == '\\')
+            return LEX_STRING;
+         i = end;
+      }
+      else if (c == '#' && i == firstNonSpace)
+      {
+         size_t end = i + 1;
+         while (end < n && (isalpha((unsigned char)line[end]) || line[end] == ' '))
+            end++;
+         push(i, end, TOKEN_PREPROCESSOR);
+         i = end;
+      }
+      else if (isdigit((unsigned char)c))
+      {
+         size_t end = i + 1;
+         while (end < n && (isalnum((unsigned char)line[end]) || line[end] == '.' || line[end] == '\''))
+            end++;
+         push(i, end, TOKEN_NUMBER);
+         i = end;
+      }
+      else if (isalpha((unsigned char)c) || c == '_')
+      {
+         size_t end = i + 1;
+         while (end < n && (isalnum((unsigned char)line[end]) || line[end] == '_'))
+            end++;
+         if (isKeyword(line.data() + i, end - i))
+            push(i, end, TOKEN_KEYWORD);
+         i = end;
+      }
+      else
+         i++;
+   }
+   return LEX_NORMAL;
+}
+
+bool isSourceFile(const std::string &path)
+{
+   static const char *extensions[] = {".c", ".cc", ".cpp", ".cxx", ".h", ".hh", ".hpp", ".inl", ".glsl", ".vert", ".frag"};
+   size_t dot = path.find_last_of('.');
+   if (dot == std::string::npos)
+      return false;
+   std::string extension = path.substr(dot);
+   for (char &c : extension)
+      c = (char)tolower((unsigned char)c);
+   for (const char *e : extensions)
+      if (extension == e)
+         return true;
+   return false;
+}
+
+// -------- Highlighter --------
+
+static const size_t kSyncLines = 2000;   // furthest the viewport may lex ahead of the frontier itself
+static const size_t kJobLines = 4096;    // lines per worker job
+static const size_t kMaxLineLength = 4096;
+
+Highlighter::Highlighter(const Document &document)
+    : document(document)
+{
+   worker = std::thread(&Highlighter::workerLoop, this);
+}
+
+Highlighter::~Highlighter()
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+   }
+   wake.notify_one();
+   worker.join();
+}
+
+void Highlighter::reset()
+{
+   version = document.version();
+   states.clear();
+   lineSpans.clear();
+   lexed.clear();
+   validTo = 0;
+   convergeTo = 0;
+   dirtyEnd = 0;
+}
+
+void Highlighter::resize(size_t lines)
+{
+   if (lines <= states.size())
+      return;
+   states.resize(lines, LEX_NORMAL);
+   lineSpans.resize(lines);
+   lexed.resize(lines, 0);
+}
+
+// Adjust a line number for lines [line, line + removed] becoming [line, line + inserted]
+static size_t shiftLine(size_t value, size_t line, size_t removed, size_t inserted)
+{
+   if (value > line + removed)
+      return value - removed + inserted;
+   return std::min(value, line);
+}
+
+void Highlighter::edited(size_t line, size_t removed, size_t inserted)
+{
+   version = document.version();
+   if (line >= states.size())
+   {
+      resize(document.lineCount());
+      return;
+   }
+
+   size_t removeEnd = std::min(line + 1 + removed, states.size());
+   states.erase(states.begin() + line + 1, states.begin() + removeEnd);
+   lineSpans.erase(lineSpans.begin() + line + 1, lineSpans.begin() + removeEnd);
+   lexed.erase(lexed.begin() + line + 1, lexed.begin() + removeEnd);
+   states.insert(states.begin() + line + 1, inserted, LEX_NORMAL);
+   lineSpans.insert(lineSpans.begin() + line + 1, inserted, std::vector<TokenSpan>());
+   lexed.insert(lexed.begin() + line + 1, inserted, 0);
+   lexed[line] = 0;
+
+   // everything past the frontier that was right before the edit may become right again
+   if (line < validTo)
+   {
+      convergeTo = shiftLine(std::max(convergeTo, validTo), line, removed, inserted);
+      validTo = line;
+   }
+   else
+      convergeTo = shiftLine(convergeTo, line, removed, inserted);
+
+   // the chain can't be declared converged before it has passed every changed line
+   dirtyEnd = std::max(shiftLine(dirtyEnd, line, removed, inserted), line + inserted);
+   resize(document.lineCount());
+}
+
+// Record the lexed frontier line and move the frontier past it
+void Highlighter::advance(size_t line, LexState endState, std::vector<TokenSpan> &&spans)
+{
+   lineSpans[line] = std::move(spans);
+   lexed[line] = 1;
+
+   size_t next = line + 1;
+   if (next >= states.size())
+   {
+      validTo = std::max(validTo, line);
+      return;
+   }
+
+   if (states[next] == endState && next > dirtyEnd && next <= convergeTo)
+   {
+      // same state entering an unchanged line: everything cached up to convergeTo holds
+      validTo = std::min(convergeTo, states.size() - 1);
+      return;
+   }
+   if (states[next] != endState)
+   {
+      states[next] = endState;
+      lexed[next] = 0;
+   }
+   validTo = next;
+   convergeTo = std::max(convergeTo, validTo);
+}
+
+void Highlighter::lexTo(size_t line)
+{
+   std::vector<std::string> text;
+   std::vector<TokenSpan> spans;
+   while (validTo < line)
+   {
+      size_t first = validTo;
+      document.lines(first, line - first, text, kMaxLineLength);
+      if (text.empty())
+         return;
+      for (size_t i = 0; i < text.size() && validTo == first + i; i++)
+      {
+         LexState end = lexLine(text[i], states[first + i], spans);
+         advance(first + i, end, std::move(spans));
+      }
+      if (validTo == first)
+         return;
+   }
+}
+
+const std::vector<TokenSpan> &Highlighter::spans(size_t line)
+{
+   resize(document.lineCount());
+   if (line >= states.size())
+   {
+      provisional.clear();
+      return provisional;
+   }
+
+   if (line > validTo)
+   {
+      if (lexed[line] || line - validTo > kSyncLines)
+      {
+         // far ahead of the frontier: show what we have until the worker gets there
+         if (!lexed[line])
+            lexLine(document.line(line, kMaxLineLength), states[line], provisional);
+         return lexed[line] ? lineSpans[line] : provisional;
+      }
+      lexTo(line);
+   }
+
+   if (!lexed[line])
+   {
+      std::vector<TokenSpan> spans;
+      LexState end = lexLine(document.line(line, kMaxLineLength), states[line], spans);
+      if (line == validTo)
+         advance(line, end, std::move(spans));
+      else
+      {
+         lineSpans[line] = std::move(spans);
+         lexed[line] = 1;
+      }
+   }
+   return lineSpans[line];
+}
+
+void Highlighter::update()
+{
+   resize(document.lineCount());
+
+   std::unique_lock<std::mutex> lock(mutex);
+   if (busy && !jobDone)
+      return;
+
+   if (busy && jobDone)
+   {
+      busy = false;
+      jobDone = false;
+
+      // merge from wherever the frontier is now, if the chain still matches
+      size_t end = job.firstLine + job.endStates.size();
+      if (job.version == version && validTo >= job.firstLine && validTo < end)
+      {
+         size_t k = validTo - job.firstLine;
+         LexState entering = k == 0 ? job.state : job.endStates[k - 1];
+         if (states[validTo] == entering)
+         {
+            for (; k < job.endStates.size() && validTo == job.firstLine + k; k++)
+               advance(job.firstLine + k, job.endStates[k], std::move(job.spans[k]));
+         }
+      }
+   }
+
+   if (validTo + 1 >= states.size())
+      return;
+
+   job.version = version;
+   job.firstLine = validTo;
+   job.state = states[validTo];
+   document.lines(validTo, kJobLines, job.lines, kMaxLineLength);
+   if (job.lines.empty())
+      return;
+   busy = true;
+   lock.unlock();
+   wake.notify_one();
+}
+
+void Highlighter::workerLoop()
+{
+   std::unique_lock<std::mutex> lock(mutex);
+   while (true)
+   {
+      wake.wait(lock, [this]
+                { return stopping || (busy && !jobDone); });
+      if (stopping)
+         return;
+
+      lock.unlock();
+      job.endStates.resize(job.lines.size());
+      job.spans.resize(job.lines.size());
+      LexState state = job.state;
+      for (size_t i = 0; i < job.lines.size(); i++)
+      {
+         state = lexLine(job.lines[i], state, job.spans[i]);
+         job.endStates[i] = state;
+      }
+      lock.lock();
+      jobDone = true;
+   }
+}
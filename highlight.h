@@ -0,0 +1,105 @@
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Document;
+
+enum TokenKind : uint8_t
+{
+   TOKEN_TEXT,
+   TOKEN_KEYWORD,
+   TOKEN_NUMBER,
+   TOKEN_STRING,
+   TOKEN_COMMENT,
+   TOKEN_PREPROCESSOR
+};
+
+struct TokenSpan
+{
+   uint32_t start;
+   uint32_t length;
+   TokenKind kind;
+};
+
+// Lexer state carried from the end of one line to the start of the next
+enum LexState : uint8_t
+{
+   LEX_NORMAL,
+   LEX_BLOCK_COMMENT,
+   LEX_STRING
+};
+
+// Tokenize one line of C-like source; returns the state at the end of the line
+LexState lexLine(const std::string &line, LexState state, std::vector<TokenSpan> &spans);
+
+bool isSourceFile(const std::string &path);
+
+// Incremental highlighter. The lexer state at the start of every line is cached;
+// states are known to be correct up to the frontier. An edit moves the frontier
+// back to the edited line, and re-lexing stops as soon as the state entering a
+// line matches the cached one again. Lines beyond the viewport are lexed by a
+// worker thread on a copy of the text, and its results are only merged if the
+// document version they were made from is still current.
+class Highlighter
+{
+public:
+   explicit Highlighter(const Document &document);
+   ~Highlighter();
+   Highlighter(const Highlighter &) = delete;
+   Highlighter &operator=(const Highlighter &) = delete;
+
+   // Forget everything, e.g. after a new file was opened
+   void reset();
+   // Lines [line, line + removed] were replaced by [line, line + inserted]
+   void edited(size_t line, size_t removed, size_t inserted);
+   // Merge worker results and hand it the next region; call once per frame
+   void update();
+   // Spans for a visible line; lexes synchronously up to it if close enough
+   const std::vector<TokenSpan> &spans(size_t line);
+
+   size_t frontier() const { return validTo; }
+
+private:
+   struct Job
+   {
+      uint64_t version;
+      size_t firstLine;
+      LexState state;
+      std::vector<std::string> lines;
+      std::vector<LexState> endStates;
+      std::vector<std::vector<TokenSpan>> spans;
+   };
+
+   void resize(size_t lines);
+   void advance(size_t line, LexState endState, std::vector<TokenSpan> &&lineSpans);
+   void lexTo(size_t line);
+   void workerLoop();
+
+   const Document &document;
+   uint64_t version = 0;
+
+   std::vector<LexState> states;                 // state at the start of each line
+   std::vector<std::vector<TokenSpan>> lineSpans; // valid where lexed[i] is set
+   std::vector<uint8_t> lexed;
+   size_t validTo = 0;    // states[0..validTo] are correct
+   size_t convergeTo = 0; // states up to here become correct again once the chain re-converges
+   size_t dirtyEnd = 0;   // last line changed by an edit the frontier hasn't passed yet
+   std::vector<TokenSpan> provisional;
+
+   std::mutex mutex;
+   std::condition_variable wake;
+   bool stopping = false;
+   bool busy = false;
+   Job job;
+   bool jobDone = false;
+   std::thread worker;
+};
+
+#endif
@@ -0,0 +1,175 @@
+#include "image.h"
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#include <iostream>
+
+ImageCache::ImageCache(TextureUploader &uploader, int workers)
+    : atlas(1024, GL_RGBA8, GL_RGBA), uploader(uploader)
+{
+   if ((IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG) & IMG_INIT_PNG) == 0)
+      std::cerr << "IMG_Init failed: " << IMG_GetError() << std::endl;
+   imageLibrary = true;
+
+   for (int i = 0; i < workers; i++)
+      threads.emplace_back(&ImageCache::workerLoop, this);
+}
+
+ImageCache::~ImageCache()
+{
+   shutdown();
+}
+
+void ImageCache::shutdown()
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+   }
+   wake.notify_all();
+   for (std::thread &thread : threads)
+      thread.join();
+   threads.clear();
+   // decoders are done with it, and SDL_Quit hasn't run yet
+   if (imageLibrary)
+      IMG_Quit();
+   imageLibrary = false;
+}
+
+void ImageCache::release()
+{
+   // textures still waiting in uploading were already made too
+   for (auto &entry : images)
+   {
+      Image &image = entry.second;
+      if (!image.inAtlas && image.texture != 0)
+         glDeleteTextures(1, &image.texture);
+   }
+   images.clear();
+   uploading.clear();
+   atlas.release();
+   shutdown();
+}
+
+const Image &ImageCache::get(const std::string &path)
+{
+   auto found = images.find(path);
+   if (found != images.end())
+      return found->second;
+
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending.push_back(path);
+   }
+   wake.notify_one();
+   return images[path];
+}
+
+void ImageCache::workerLoop()
+{
+   std::unique_lock<std::mutex> lock(mutex);
+   while (true)
+   {
+      wake.wait(lock, [this]
+                { return stopping || !pending.empty(); });
+      if (stopping)
+         return;
+
+      Decoded result = {pending.front(), 0, 0, {}};
+      pending.pop_front();
+      lock.unlock();
+
+      SDL_RWops *rw = SDL_RWFromFile(result.path.c_str(), "rb");
+      SDL_Surface *surface = rw ? IMG_Load_RW(rw, 1) : nullptr;
+      SDL_Surface *rgba = surface ? SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ABGR8888, 0) : nullptr;
+      if (rgba)
+      {
+         result.width = rgba->w;
+         result.height = rgba->h;
+         result.pixels.resize((size_t)rgba->w * rgba->h * 4);
+
+         SDL_LockSurface(rgba);
+         for (int y = 0; y < rgba->h; y++)
+         {
+            const unsigned char *src = (const unsigned char *)rgba->pixels + (size_t)y * rgba->pitch;
+            unsigned char *dst = result.pixels.data() + (size_t)y * rgba->w * 4;
+            for (int x = 0; x < rgba->w; x++, src += 4, dst += 4)
+            {
+               unsigned int a = src[3];
+               dst[0] = (unsigned char)((src[0] * a + 127) / 255);
+               dst[1] = (unsigned char)((src[1] * a + 127) / 255);
+               dst[2] = (unsigned char)((src[2] * a + 127) / 255);
+               dst[3] = (unsigned char)a;
+            }
+         }
+         SDL_UnlockSurface(rgba);
+      }
+      else
+         std::cerr << "Failed to load image " << result.path << ": " << IMG_GetError() << std::endl;
+
+      if (rgba)
+         SDL_FreeSurface(rgba);
+      if (surface)
+         SDL_FreeSurface(surface);
+
+      lock.lock();
+      decoded.push_back(std::move(result));
+   }
+}
+
+void ImageCache::update()
+{
+   // images become drawable once all of their rows have reached the texture
+   for (size_t i = 0; i < uploading.size();)
+   {
+      if (uploader.isComplete(uploading[i].second))
+      {
+         images[uploading[i].first].ready = true;
+         uploading[i] = uploading.back();
+         uploading.pop_back();
+      }
+      else
+         i++;
+   }
+
+   std::vector<Decoded> ready;
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      ready.swap(decoded);
+   }
+
+   for (Decoded &result : ready)
+   {
+      Image &image = images[result.path];
+      if (result.pixels.empty())
+      {
+         image.failed = true;
+         continue;
+      }
+      image.width = result.width;
+      image.height = result.height;
+
+      AtlasRegion region;
+      if (result.width <= kAtlasMaxSize && result.height <= kAtlasMaxSize && atlas.add(result.width, result.height, region))
+      {
+         image.texture = atlas.texture(region.page);
+         image.inAtlas = true;
+         image.u0 = region.u0;
+         image.v0 = region.v0;
+         image.u1 = region.u1;
+         image.v1 = region.v1;
+      }
+      else
+      {
+         glGenTextures(1, &image.texture);
+         glBindTexture(GL_TEXTURE_2D, image.texture);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, result.width, result.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+         region = {0, 0, 0, result.width, result.height, 0, 0, 1, 1};
+      }
+      uint64_t ticket = uploader.upload(image.texture, region.x, region.y, region.w, region.h, GL_RGBA,
+                                        result.pixels.data(), 0, false);
+      uploading.push_back({result.path, ticket});
+   }
+}
@@ -0,0 +1,76 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "atlas.h"
+#include "upload.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct Image
+{
+   int width = 0;
+   int height = 0;
+   GLuint texture = 0;
+   float u0 = 0, v0 = 0, u1 = 1, v1 = 1;
+   bool inAtlas = false;
+   bool ready = false;
+   bool failed = false;
+};
+
+// Loads PNG/JPEG files with SDL2_image on worker threads. Decoding, conversion
+// to RGBA and alpha premultiplication all happen off the render thread, which
+// only hands finished pixels to the texture uploader within its frame budget.
+// Images up to kAtlasMaxSize go into shared atlas pages so icons can be drawn
+// in one batch.
+class ImageCache
+{
+public:
+   static constexpr int kAtlasMaxSize = 128;
+
+   explicit ImageCache(TextureUploader &uploader, int workers = 2);
+   ~ImageCache();
+   ImageCache(const ImageCache &) = delete;
+   ImageCache &operator=(const ImageCache &) = delete;
+
+   // The image for a path, queueing its decode on first use; draw it once ready is set
+   const Image &get(const std::string &path);
+   // Upload whatever finished decoding since the last call; GL thread only
+   void update();
+   // Delete every texture the cache made and shut down; GL thread, before SDL_Quit
+   void release();
+   // Stop the decoders and SDL_image without touching GL, for exits before
+   // there is a context; release() does this too. Has to come before SDL_Quit
+   void shutdown();
+
+private:
+   struct Decoded
+   {
+      std::string path;
+      int width;
+      int height;
+      std::vector<unsigned char> pixels; // premultiplied RGBA8, tightly packed
+   };
+
+   void workerLoop();
+
+   std::unordered_map<std::string, Image> images;
+   std::vector<std::pair<std::string, uint64_t>> uploading;
+   TextureAtlas atlas;
+   TextureUploader &uploader;
+
+   std::mutex mutex;
+   std::condition_variable wake;
+   std::deque<std::string> pending;
+   std::vector<Decoded> decoded;
+   bool stopping = false;
+   std::vector<std::thread> threads;
+   bool imageLibrary = false; // IMG_Init still needs its IMG_Quit
+};
+
+#endif
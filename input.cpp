@@ -0,0 +1,55 @@
+#include "input.h"
+
+void InputQueue::pump()
+{
+   coalesced.clear();
+   motion.clear();
+   drained = 0;
+
+   SDL_PumpEvents();
+   while (true)
+   {
+      int count = SDL_PeepEvents(buffer, kBatch, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT);
+      if (count <= 0)
+         break;
+      drained += count;
+
+      for (int i = 0; i < count; i++)
+      {
+         const SDL_Event &event = buffer[i];
+         SDL_Event *last = coalesced.empty() ? nullptr : &coalesced.back();
+
+         if (event.type == SDL_MOUSEMOTION)
+         {
+            motion.push_back({event.motion.x, event.motion.y, event.motion.state, event.motion.timestamp});
+            if (last && last->type == SDL_MOUSEMOTION && last->motion.windowID == event.motion.windowID &&
+                last->motion.which == event.motion.which)
+            {
+               // latest position and buttons, accumulated relative motion, first timestamp
+               last->motion.x = event.motion.x;
+               last->motion.y = event.motion.y;
+               last->motion.state = event.motion.state;
+               last->motion.xrel += event.motion.xrel;
+               last->motion.yrel += event.motion.yrel;
+               continue;
+            }
+         }
+         else if (event.type == SDL_MOUSEWHEEL && last && last->type == SDL_MOUSEWHEEL &&
+                  last->wheel.windowID == event.wheel.windowID && last->wheel.which == event.wheel.which &&
+                  last->wheel.direction == event.wheel.direction)
+         {
+            last->wheel.x += event.wheel.x;
+            last->wheel.y += event.wheel.y;
+            last->wheel.preciseX += event.wheel.preciseX;
+            last->wheel.preciseY += event.wheel.preciseY;
+            last->wheel.mouseX = event.wheel.mouseX;
+            last->wheel.mouseY = event.wheel.mouseY;
+            continue;
+         }
+         coalesced.push_back(event);
+      }
+
+      if (count < kBatch)
+         break;
+   }
+}
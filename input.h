@@ -0,0 +1,43 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <SDL2/SDL.h>
+#include <vector>
+
+struct MotionSample
+{
+   int x, y;
+   Uint32 buttons;
+   Uint32 timestamp;
+};
+
+// One frame's input. pump() drains SDL's queue in bulk with SDL_PeepEvents
+// rather than one SDL_PollEvent call per event, then collapses each run of
+// consecutive mouse motion into a single event and each run of wheel events
+// into one with the summed deltas. Runs end at any other event, so a click
+// still sees the pointer where it was at the time. A 1000 Hz mouse therefore
+// costs one hover/hit-test pass per frame; drawing tools that want every
+// sample read motionHistory(). A merged event keeps the timestamp of the
+// first event it absorbed, so latency is counted from the oldest input.
+class InputQueue
+{
+public:
+   static constexpr int kBatch = 256; // events per SDL_PeepEvents call
+
+   void pump();
+
+   const std::vector<SDL_Event> &events() const { return coalesced; }
+   // Every motion event of the frame, oldest first
+   const std::vector<MotionSample> &motionHistory() const { return motion; }
+
+   // Events SDL delivered in the last pump, before coalescing
+   int received() const { return drained; }
+
+private:
+   SDL_Event buffer[kBatch];
+   std::vector<SDL_Event> coalesced;
+   std::vector<MotionSample> motion;
+   int drained = 0;
+};
+
+#endif
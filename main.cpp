@@ -1,340 +1,1312 @@
-#include <windows.h>
 #include <glad/glad.h>
 #include <SDL2/SDL_ttf.h>
 #include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <vector>
+#include <memory>
+#include <thread>
 #include <iostream>
+#include "document.h"
+#include "utf8.h"
+#include "highlight.h"
+#include "image.h"
+#include "upload.h"
+#include "glyphs.h"
+#include "raster.h"
+#include "golden.h"
+#include "capture.h"
+#include "drawlist.h"
+#include "clip.h"
+#include "pacing.h"
+#include "input.h"
+#include "window.h"
+#include "startup.h"
 
 #undef main
 
 const char *textVertexShaderSource = R"(#version 330 core
 layout (location = 0) in vec2 aPos;
 layout (location = 1) in vec2 aTexCoord;
+layout (location = 2) in vec4 aColor;
 
 out vec2 TexCoord;
+out vec4 Color;
 
 uniform mat4 uProjection;
+uniform float uPositionScale; // window units per position unit; 1 with float vertices
 
 void main() {
-    gl_Position = uProjection * vec4(aPos, 0.0, 1.0);
+    gl_Position = uProjection * vec4(aPos * uPositionScale, 0.0, 1.0);
     TexCoord = aTexCoord;
+    Color = aColor;
 }
 
 )";
 
 const char *textFragmentShaderSource = R"(#version 330 core
 in vec2 TexCoord;
+in vec4 Color;
 out vec4 FragColor;
 
 uniform sampler2D uTexture;
+// set while GL_FRAMEBUFFER_SRGB is on: colors go out linear and blend in linear light
+uniform bool uLinearBlend;
+
+vec3 toLinear(vec3 c) {
+    return mix(c / 12.92, pow((c + 0.055) / 1.055, vec3(2.4)), step(0.04045, c));
+}
 
 void main() {
-    FragColor = texture(uTexture, TexCoord);
+    vec4 color = texture(uTexture, TexCoord) * Color;
+    if (uLinearBlend)
+        color.rgb = toLinear(color.rgb);
+    FragColor = color;
 }
 
 )";
 
-// Vertex Shader
+// Every texture upload, glyphs included, is staged through this
+TextureUploader textureUploader;
+
+// Rect shader: one instanced quad per rectangle, shaded from a rounded-box distance field
 const char *vertexShaderSource = R"(#version 330 core
-layout (location = 0) in vec2 aPos;
+layout (location = 0) in vec2 aCorner;
+layout (location = 1) in vec4 aRect;   // x, y, w, h
+layout (location = 2) in vec4 aRadii;  // top-left, top-right, bottom-right, bottom-left
+layout (location = 3) in vec4 aFill;
+layout (location = 4) in vec4 aParams; // border width, shadow blur, shadow offset
+layout (location = 5) in vec4 aBorderColor;
+layout (location = 6) in vec4 aShadowColor;
+layout (location = 7) in vec4 aClip;   // x0, y0, x1, y1
+
 uniform mat4 uProjection;
+uniform float uPositionScale; // window units per unit of aRect, aRadii, aParams and aClip
+
+out vec2 Local; // from the rect's center
+flat out vec2 HalfSize;
+flat out vec4 Radii;
+flat out vec4 Fill;
+flat out vec4 Params;
+flat out vec4 BorderColor;
+flat out vec4 ShadowColor;
+
 void main() {
-    gl_Position = uProjection * vec4(aPos, 0.0, 1.0);
+    vec4 rect = aRect * uPositionScale, params = aParams * uPositionScale, clip = aClip * uPositionScale;
+
+    // cover the shadow out to three standard deviations, plus a pixel for antialiasing
+    vec2 lo = rect.xy, hi = rect.xy + rect.zw;
+    if (aShadowColor.a > 0.0) {
+        float reach = params.y * 1.5;
+        lo = min(lo, rect.xy + params.zw - reach);
+        hi = max(hi, rect.xy + rect.zw + params.zw + reach);
+    }
+    vec2 pos = clamp(mix(lo - 1.0, hi + 1.0, aCorner), clip.xy, clip.zw);
+    gl_Position = uProjection * vec4(pos, 0.0, 1.0);
+
+    HalfSize = rect.zw * 0.5;
+    Local = pos - rect.xy - HalfSize;
+    Radii = aRadii * uPositionScale;
+    Fill = aFill;
+    Params = params;
+    BorderColor = aBorderColor;
+    ShadowColor = aShadowColor;
 }
 )";
 
-// Fragment Shader
 const char *fragmentShaderSource = R"(#version 330 core
+in vec2 Local;
+flat in vec2 HalfSize;
+flat in vec4 Radii;
+flat in vec4 Fill;
+flat in vec4 Params;
+flat in vec4 BorderColor;
+flat in vec4 ShadowColor;
 out vec4 FragColor;
-uniform vec3 uColor;
+
+// Signed distance to a box with a radius per corner; y grows downwards
+float roundBox(vec2 p, vec2 halfSize, vec4 radii) {
+    float r = p.x < 0.0 ? (p.y < 0.0 ? radii.x : radii.w) : (p.y < 0.0 ? radii.y : radii.z);
+    vec2 q = abs(p) - halfSize + r;
+    return min(max(q.x, q.y), 0.0) + length(max(q, 0.0)) - r;
+}
+
+// Abramowitz and Stegun, error below 5e-4
+float erfApprox(float x) {
+    float s = sign(x), a = abs(x);
+    float t = 1.0 + (0.278393 + (0.230389 + 0.078108 * (a * a)) * a) * a;
+    t *= t;
+    return s - s / (t * t);
+}
+
 void main() {
-    FragColor = vec4(uColor, 1.0);
+    // a device-pixel-wide ramp centered on the edge: exact coverage for edges on pixel
+    // boundaries, and as sharp on HiDPI as on 1x since the ramp is measured in pixels
+    float pixels = 1.0 / max(fwidth(Local.x), 1e-4);
+    float d = roundBox(Local, HalfSize, Radii);
+    vec4 color = Fill;
+    if (Params.x > 0.0)
+        color = mix(BorderColor, Fill, clamp(0.5 - (d + Params.x) * pixels, 0.0, 1.0));
+    vec4 shape = vec4(color.rgb * color.a, color.a) * clamp(0.5 - d * pixels, 0.0, 1.0);
+
+    // the blurred box is approximated by a Gaussian across its distance field
+    vec4 shadow = vec4(0.0);
+    if (ShadowColor.a > 0.0) {
+        float sigma = max(Params.y * 0.5, 0.25);
+        float amount = 0.5 - 0.5 * erfApprox(roundBox(Local - Params.zw, HalfSize, Radii) / (sigma * 1.4142136));
+        shadow = vec4(ShadowColor.rgb * ShadowColor.a, ShadowColor.a) * amount;
+    }
+    FragColor = shape + shadow * (1.0 - shape.a);
 }
 )";
 
-// Generate rectangle vertex positions from center x, y
-std::vector<float> generateRectangleVertices(float cx, float cy, float width, float height)
+// A program whose compile and link were issued but not yet checked
+struct PendingProgram
 {
-   float halfW = width / 2.0f;
-   float halfH = height / 2.0f;
-   float x1 = cx - halfW;
-   float x2 = cx + halfW;
-   float y1 = cy - halfH;
-   float y2 = cy + halfH;
-
-   return {
-       x1, y1, x2, y1, x1, y2,
-       x2, y1, x1, y2, x2, y2};
-}
+   unsigned int program, vs, fs;
+};
 
-// Compile shader
+// Compile shader; its status is read when the program is finished
 unsigned int compileShader(unsigned int type, const char *source)
 {
    unsigned int shader = glCreateShader(type);
    glShaderSource(shader, 1, &source, nullptr);
    glCompileShader(shader);
+   return shader;
+}
 
+// Create shader program. Nothing asks for the result here: drivers that
+// compile and link on their own threads keep going while startup does other
+// work, and only finishProgram waits for them
+PendingProgram startProgram(const char *vertexSource, const char *fragmentSource)
+{
+   PendingProgram pending;
+   pending.vs = compileShader(GL_VERTEX_SHADER, vertexSource);
+   pending.fs = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+   pending.program = glCreateProgram();
+   glAttachShader(pending.program, pending.vs);
+   glAttachShader(pending.program, pending.fs);
+   glLinkProgram(pending.program);
+   return pending;
+}
+
+unsigned int finishProgram(const PendingProgram &pending)
+{
    int success;
    char infoLog[512];
-   glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+   for (unsigned int shader : {pending.vs, pending.fs})
+   {
+      glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+      if (!success)
+      {
+         glGetShaderInfoLog(shader, 512, nullptr, infoLog);
+         std::cerr << "Shader compilation error:\n"
+                   << infoLog << std::endl;
+      }
+      glDeleteShader(shader);
+   }
+   glGetProgramiv(pending.program, GL_LINK_STATUS, &success);
    if (!success)
    {
-      glGetShaderInfoLog(shader, 512, nullptr, infoLog);
-      std::cerr << "Shader compilation error:\n"
+      glGetProgramInfoLog(pending.program, 512, nullptr, infoLog);
+      std::cerr << "Shader link error:\n"
                 << infoLog << std::endl;
    }
-   return shader;
+   return pending.program;
 }
 
-// Create shader program
-unsigned int createShaderProgram()
-{
-   unsigned int vs = compileShader(GL_VERTEX_SHADER, vertexShaderSource);
-   unsigned int fs = compileShader(GL_FRAGMENT_SHADER, fragmentShaderSource);
-   unsigned int program = glCreateProgram();
-   glAttachShader(program, vs);
-   glAttachShader(program, fs);
-   glLinkProgram(program);
-   glDeleteShader(vs);
-   glDeleteShader(fs);
-   return program;
-}
+// Everything on screen is recorded here during a frame and batched on submit
+DrawList drawList;
+
+// Clips for everything recorded; push around anything that must stay inside a panel
+ClipStack clipStack;
 
-unsigned int createTextShaderProgram()
+// Record a solid rectangle by its center
+void drawRectangle(float x, float y, float width, float height, float r, float g, float b)
 {
-   unsigned int vs = compileShader(GL_VERTEX_SHADER, textVertexShaderSource);
-   unsigned int fs = compileShader(GL_FRAGMENT_SHADER, textFragmentShaderSource);
-   unsigned int program = glCreateProgram();
-   glAttachShader(program, vs);
-   glAttachShader(program, fs);
-   glLinkProgram(program);
-   glDeleteShader(vs);
-   glDeleteShader(fs);
-   return program;
+   drawList.rect(x - width / 2.0f, y - height / 2.0f, width, height, r, g, b);
 }
 
-// Draw a rectangle at position with color
-void drawRectangle(GLuint shaderProgram, float x, float y, float width, float height, float r, float g, float b)
-{
-   std::vector<float> vertices = generateRectangleVertices(x, y, width, height);
+// now we are going to render the text
 
-   GLuint VAO, VBO;
-   glGenVertexArrays(1, &VAO);
-   glGenBuffers(1, &VBO);
+// Syntax colors for highlighted spans
+SDL_Color tokenColor(TokenKind kind)
+{
+   switch (kind)
+   {
+   case TOKEN_KEYWORD:
+      return {86, 156, 214, 255};
+   case TOKEN_NUMBER:
+      return {181, 206, 168, 255};
+   case TOKEN_STRING:
+      return {206, 145, 120, 255};
+   case TOKEN_COMMENT:
+      return {106, 153, 85, 255};
+   case TOKEN_PREPROCESSOR:
+      return {197, 134, 192, 255};
+   default:
+      return {255, 255, 255, 255};
+   }
+}
 
-   glBindVertexArray(VAO);
-   glBindBuffer(GL_ARRAY_BUFFER, VBO);
-   glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+// -------- Main Loop --------
 
-   glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), nullptr);
-   glEnableVertexAttribArray(0);
+// Glyphs live in an R8 atlas and every string goes out as quads on the draw list
+GlyphCache glyphCache(textureUploader);
 
-   glUseProgram(shaderProgram);
-   glUniform3f(glGetUniformLocation(shaderProgram, "uColor"), r, g, b);
+// Text is tinted per vertex, so highlighted spans only change glyph colors
+int renderText(const std::string &text, float x, float y, SDL_Color color, const std::vector<TokenSpan> *spans = nullptr)
+{
+   if (!glyphCache.isOpen())
+      return -1;
+   glyphCache.draw(drawList, text, x, y, color, spans, tokenColor);
+   return 0;
+}
 
-   glDrawArrays(GL_TRIANGLES, 0, 6);
+// Clear and draw everything recorded this frame into a target drawableWidth device pixels wide
+void submitFrame(const float *ortho, int drawableWidth)
+{
+   glClearColor(0.12f, 0.12f, 0.12f, 1.0f); // dark bg
+   glClear(GL_COLOR_BUFFER_BIT);
+   // glyphs and icons recorded this frame have to reach their atlases before the draws
+   textureUploader.flush();
+   drawList.submit(ortho, drawableWidth);
+}
 
-   glDeleteBuffers(1, &VBO);
-   glDeleteVertexArrays(1, &VAO);
+// Top bar layout shared by the GL and software paths
+struct MenuItem
+{
+   const char *label;
+   const char *icon;
+   float x;
+};
+const MenuItem menuItems[] = {{"File", "icons/file.png", 8.0f}, {"Edit", "icons/edit.png", 84.0f}};
+const float iconSize = 16.0f;
+const float barHeight = 40.0f;
+const float lineHeight = 30.0f;
+
+const RectStyle barStyle = {{0.3f, 0.3f, 0.35f, 1.0f}, {0.0f, 0.0f, 0.0f, 0.0f}, 0.0f, {0.0f, 0.0f, 0.0f, 0.0f},
+                            8.0f, 0.0f, 2.0f, {0.0f, 0.0f, 0.0f, 0.4f}};
+const RectStyle hoverStyle = {{0.4f, 0.4f, 0.47f, 1.0f}, {4.0f, 4.0f, 4.0f, 4.0f}};
+
+// Menu item under a point in the bar, or -1
+int menuItemAt(int x, int y)
+{
+   if (y < 0 || y >= barHeight)
+      return -1;
+   for (int i = 0; i < (int)(sizeof(menuItems) / sizeof(menuItems[0])); i++)
+   {
+      const MenuItem &item = menuItems[i];
+      float right = item.x + iconSize + 4.0f + glyphCache.measure(item.label) + 4.0f;
+      if (x >= item.x - 4.0f && x < right)
+         return i;
+   }
+   return -1;
 }
 
-// now we are going to render the text
+// Records the bar with its icons and labels, on a layer above the page so
+// its shadow falls over scrolled text. False while an icon is still loading
+bool drawTopBar(ImageCache &imageCache, int w, int hovered = -1)
+{
+   bool complete = true;
+   drawList.setLayer(1);
+   // Render top bar (stretching full width of screen), with a soft shadow onto the page
+   drawList.rect(0.0f, 0.0f, (float)w, barHeight, barStyle);
+   if (hovered >= 0)
+   {
+      const MenuItem &item = menuItems[hovered];
+      float width = iconSize + 4.0f + glyphCache.measure(item.label) + 8.0f;
+      drawList.rect(item.x - 4.0f, 6.0f, width, barHeight - 12.0f, hoverStyle);
+   }
 
-// -------- Main Loop --------
+   imageCache.update();
+   for (const MenuItem &item : menuItems)
+   {
+      const Image &icon = imageCache.get(item.icon);
+      if (icon.ready)
+         drawList.quad(PIPELINE_IMAGES, icon.texture, item.x, (barHeight - iconSize) / 2.0f, iconSize, iconSize,
+                       icon.u0, icon.v0, icon.u1, icon.v1);
+      else if (!icon.failed)
+         complete = false;
+   }
 
-int renderText(SDL_Window *window, SDL_GLContext *context, float w, float h, std::string text, float x, float y, SDL_Color color)
+   SDL_Color textColor = {255, 255, 255, 255}; // white text
+   for (const MenuItem &item : menuItems)
+      renderText(item.label, item.x + iconSize + 4.0f, 2.0f, textColor);
+   drawList.setLayer(0);
+   return complete;
+}
+
+// Rasterize the bar's labels at the positions drawTopBar puts them, so the
+// first frame finds their glyphs, subpixel bins included, in the atlas
+void prewarmTopBar()
 {
-   GLuint textShaderProgram = createTextShaderProgram();
+   std::vector<PlacedGlyph> placed;
+   for (const MenuItem &item : menuItems)
+      glyphCache.layout(item.label, item.x + iconSize + 4.0f, 2.0f, SDL_Color{255, 255, 255, 255}, nullptr, nullptr, placed);
+}
 
-   if (TTF_Init() == -1)
+// Golden-image scenes: main.exe --golden [--update]. The first is the real top
+// bar; the others stress text, highlighting, rectangles and clipping.
+int runGolden(ImageCache &imageCache, bool update)
+{
+   // icons load asynchronously; the scenes need them in place
+   for (int i = 0; i < 400; i++)
    {
-      std::cerr << "TTF_Init failed: " << TTF_GetError() << std::endl;
-      SDL_GL_DeleteContext(context);
-      SDL_DestroyWindow(window);
-      SDL_Quit();
-      return -1;
+      imageCache.update();
+      textureUploader.flush();
+      textureUploader.endFrame();
+      if (imageCache.get(menuItems[0].icon).ready && imageCache.get(menuItems[1].icon).ready)
+         break;
+      SDL_Delay(5);
    }
 
-   TTF_Font *font = TTF_OpenFont("OpenSans.ttf", 24);
-   if (!font)
+   static const char *sampleSource[] = {
+       "#include <vector>",
+       "",
+       "/* Sum the squares of a range of",
+       "   values, skipping negatives */",
+       "int sumSquares(const std::vector<int> &values)",
+       "{",
+       "   int total = 0;",
+       "   for (int value : values)",
+       "   {",
+       "      if (value < 0)",
+       "         continue; // ignored",
+       "      total += value * value;",
+       "   }",
+       "   const char *label = \"sum: \";",
+       "   return total + 0x10 - 16;",
+       "}"};
+   std::vector<std::string> sampleLines(std::begin(sampleSource), std::end(sampleSource));
+   std::vector<std::vector<TokenSpan>> sampleSpans(sampleLines.size());
+   LexState state = LEX_NORMAL;
+   for (size_t i = 0; i < sampleLines.size(); i++)
+      state = lexLine(sampleLines[i], state, sampleSpans[i]);
+
+   std::vector<std::string> glyphLines;
+   for (int line = 0; line < 18; line++)
    {
-      std::cout << "error loading font" << TTF_GetError() << std::endl;
+      // Latin, Latin-1 supplement, Greek and Cyrillic
+      static const char *alphabets[] = {"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+                                        "\u00e0\u00e1\u00e2\u00e3\u00e4\u00e5\u00e6\u00e7\u00e8\u00e9\u00ea\u00eb\u00f1\u00f6\u00f8\u00fc\u00df",
+                                        "\u03b1\u03b2\u03b3\u03b4\u03b5\u03b6\u03b7\u03b8\u03bb\u03bc\u03c0\u03c3\u03c9",
+                                        "\u0430\u0431\u0432\u0433\u0434\u0435\u0436\u0437\u0438\u043a\u043b\u043c\u043d"};
+      glyphLines.push_back(std::string(alphabets[line % 4]) + " " + std::to_string(line * 7919));
    }
 
-   SDL_Surface *textSurface = TTF_RenderText_Blended(font, text.c_str(), color);
-   if (!textSurface)
+   auto projection = [](int w, int h, float *ortho)
+   {
+      float values[16] = {
+          2.0f / w, 0, 0, 0,
+          0, -2.0f / h, 0, 0,
+          0, 0, -1, 0,
+          -1, 1, 0, 1};
+      std::copy(values, values + 16, ortho);
+   };
+
+   SDL_Color white = {255, 255, 255, 255};
+   std::vector<GoldenScene> scenes = {
+       {"topbar", 800, 600, 2.0, 4, [&](int w, int h)
+        {
+           float ortho[16];
+           projection(w, h, ortho);
+           drawTopBar(imageCache, w);
+           submitFrame(ortho, w);
+           glyphCache.endFrame();
+           textureUploader.endFrame();
+        }},
+       {"document", 800, 600, 4.0, 6, [&](int w, int h)
+        {
+           float ortho[16];
+           projection(w, h, ortho);
+           drawTopBar(imageCache, w);
+           for (size_t i = 0; i < sampleLines.size(); i++)
+              if (!sampleLines[i].empty())
+                 renderText(sampleLines[i], 20.0f, barHeight + i * lineHeight, white, &sampleSpans[i]);
+           float caretX = glyphCache.measure(sampleLines[6], 9);
+           drawRectangle(20.0f + caretX, barHeight + 6 * lineHeight + lineHeight / 2.0f + 2.0f,
+                         2.0f, lineHeight - 4.0f, 0.9f, 0.9f, 0.9f);
+           submitFrame(ortho, w);
+           glyphCache.endFrame();
+           textureUploader.endFrame();
+        }},
+       {"glyphs", 800, 600, 6.0, 8, [&](int w, int h)
+        {
+           float ortho[16];
+           projection(w, h, ortho);
+           drawTopBar(imageCache, w);
+           for (size_t i = 0; i < glyphLines.size(); i++)
+              renderText(glyphLines[i], 8.0f, barHeight + i * lineHeight, white);
+           submitFrame(ortho, w);
+           glyphCache.endFrame();
+           textureUploader.endFrame();
+        }},
+       {"rects", 800, 600, 4.0, 4, [&](int w, int h)
+        {
+           float ortho[16];
+           projection(w, h, ortho);
+           drawTopBar(imageCache, w);
+           // plain, rounded, bordered and shadowed rects interleaved in one batch
+           for (int i = 0; i < 1000; i++)
+           {
+              float x = 10.0f + (i % 40) * 19.5f, y = barHeight + 10.0f + (i / 40) * 21.5f;
+              float r = (i % 7) / 6.0f, g = (i % 5) / 4.0f, b = (i % 3) / 2.0f;
+              if (i % 4 == 0)
+              {
+                 drawRectangle(x, y, 15.0f, 17.0f, r, g, b);
+                 continue;
+              }
+              RectStyle style;
+              style.fill[0] = r;
+              style.fill[1] = g;
+              style.fill[2] = b;
+              if (i % 4 == 1)
+                 std::fill(style.radii, style.radii + 4, 5.0f);
+              else if (i % 4 == 2)
+              {
+                 style.radii[0] = style.radii[2] = 6.0f;
+                 style.borderWidth = 2.0f;
+                 std::fill(style.border, style.border + 4, 1.0f);
+              }
+              else
+              {
+                 std::fill(style.radii, style.radii + 4, 3.0f);
+                 style.shadowBlur = 4.0f;
+                 style.shadowOffsetY = 2.0f;
+                 style.shadow[3] = 0.6f;
+              }
+              drawList.rect(x - 7.5f, y - 8.5f, 15.0f, 17.0f, style);
+           }
+           submitFrame(ortho, w);
+           glyphCache.endFrame();
+           textureUploader.endFrame();
+        }},
+   };
+
+   // a scrolled list inside a panel, with a nested clip around its middle column
+   scenes.push_back({"clips", 800, 600, 4.0, 6, [&](int w, int h)
+                     {
+                        float ortho[16];
+                        projection(w, h, ortho);
+                        drawTopBar(imageCache, w);
+                        RectStyle panel;
+                        std::fill(panel.radii, panel.radii + 4, 8.0f);
+                        panel.fill[0] = panel.fill[1] = 0.18f;
+                        panel.fill[2] = 0.2f;
+                        panel.shadowBlur = 12.0f;
+                        panel.shadowOffsetY = 4.0f;
+                        panel.shadow[3] = 0.5f;
+                        const float scroll = 13.5f;
+
+                        drawList.rect(100.0f, 80.0f, 420.0f, 400.0f, panel);
+                        clipStack.push(108.0f, 88.0f, 404.0f, 384.0f);
+                        for (int i = 0; i < 40; i++)
+                           if (i % 2)
+                              drawList.rect(108.0f, 88.0f - scroll + i * lineHeight, 404.0f, lineHeight, 0.22f, 0.22f, 0.25f);
+                        clipStack.push(180.0f, 0.0f, 200.0f, (float)h);
+                        for (int i = 0; i < 40; i++)
+                           drawRectangle(280.0f, 88.0f - scroll + i * lineHeight + lineHeight / 2.0f, 240.0f, 4.0f,
+                                         0.35f, 0.5f, 0.8f);
+                        clipStack.pop();
+                        for (size_t i = 0; i < glyphLines.size(); i++)
+                           renderText(glyphLines[i], 112.0f, 88.0f - scroll + i * lineHeight, white);
+                        clipStack.pop();
+                        submitFrame(ortho, w);
+                        glyphCache.endFrame();
+                        textureUploader.endFrame();
+                     }});
+
+   // the software rasterizer against the GL path: styled rects under highlighted text, and the
+   // bar with its shadow over both. Icons only exist as GL textures, so both sides leave them out
+   struct StyledRect
+   {
+      float x, y, w, h;
+      RectStyle style;
+   };
+   // a light backdrop, so the shadows and antialiased edges are well past the threshold
+   const StyledRect styledRects[] = {
+       {20.0f, 44.0f, 760.0f, 226.0f, {{0.85f, 0.85f, 0.82f, 1.0f}, {8.0f, 8.0f, 8.0f, 8.0f}}},
+       {40.0f, 80.0f, 300.0f, 150.0f, {{0.3f, 0.45f, 0.7f, 1.0f}, {14.0f, 14.0f, 14.0f, 14.0f}, 0.0f, {0.0f, 0.0f, 0.0f, 0.0f}, 12.0f, 0.0f, 4.0f, {0.0f, 0.0f, 0.0f, 0.5f}}},
+       {380.0f, 80.0f, 180.0f, 100.0f, {{0.15f, 0.3f, 0.2f, 1.0f}, {12.0f, 0.0f, 12.0f, 0.0f}, 3.0f, {0.9f, 0.6f, 0.2f, 1.0f}}},
+       {300.0f, 150.0f, 200.0f, 100.0f, {{0.8f, 0.2f, 0.3f, 0.5f}, {20.0f, 20.0f, 20.0f, 20.0f}}},
+       {600.0f, 80.0f, 160.0f, 32.0f, {{0.35f, 0.5f, 0.8f, 1.0f}, {16.0f, 16.0f, 16.0f, 16.0f}, 0.0f, {0.0f, 0.0f, 0.0f, 0.0f}, 4.0f, 2.0f, 2.0f, {0.0f, 0.0f, 0.0f, 0.6f}}},
+       {620.5f, 140.25f, 120.5f, 60.75f, {{0.25f, 0.25f, 0.3f, 1.0f}, {6.0f, 6.0f, 6.0f, 6.0f}, 1.5f, {1.0f, 1.0f, 1.0f, 1.0f}}},
+   };
+   const size_t styledLines = 10;
+   const float styledTop = 285.0f;
+
+   GlyphCache softwareGlyphs;
+   Shaper softwareShaper;
+   ShapeCache softwareShapes(softwareShaper, 0);
+   if (softwareGlyphs.init("OpenSans.ttf", 24) && softwareShaper.open("OpenSans.ttf", 24))
    {
-      std::cout << "error loading text surface" << TTF_GetError() << std::endl;
+      softwareGlyphs.setShaping(&softwareShapes);
+      GoldenScene software = {"software", 800, 600, 4.0, 4, [&](int w, int h)
+                              {
+                                 float ortho[16];
+                                 projection(w, h, ortho);
+                                 for (const StyledRect &rect : styledRects)
+                                    drawList.rect(rect.x, rect.y, rect.w, rect.h, rect.style);
+                                 for (size_t i = 0; i < styledLines; i++)
+                                    renderText(sampleLines[i], 20.0f, styledTop + i * lineHeight, white, &sampleSpans[i]);
+                                 drawList.setLayer(1);
+                                 drawList.rect(0.0f, 0.0f, (float)w, barHeight, barStyle);
+                                 for (const MenuItem &item : menuItems)
+                                    renderText(item.label, item.x + iconSize + 4.0f, 2.0f, white);
+                                 drawList.setLayer(0);
+                                 submitFrame(ortho, w);
+                                 glyphCache.endFrame();
+                                 textureUploader.endFrame();
+                              }};
+      software.expected = [&](int w, int h, std::vector<unsigned char> &pixels)
+      {
+         SoftwareRenderer renderer;
+         renderer.begin(w, h, 0.12f, 0.12f, 0.12f);
+         for (const StyledRect &rect : styledRects)
+            renderer.drawRect(rect.x, rect.y, rect.w, rect.h, rect.style);
+         for (size_t i = 0; i < styledLines; i++)
+            renderer.drawText(softwareGlyphs, sampleLines[i], 20.0f, styledTop + i * lineHeight, white, &sampleSpans[i],
+                              tokenColor);
+         renderer.drawRect(0.0f, 0.0f, (float)w, barHeight, barStyle);
+         for (const MenuItem &item : menuItems)
+            renderer.drawText(softwareGlyphs, item.label, item.x + iconSize + 4.0f, 2.0f, white);
+         renderer.finish();
+         pixels.assign(renderer.pixels(), renderer.pixels() + (size_t)w * h * 4);
+      };
+      scenes.push_back(software);
    }
+   else
+      std::cerr << "Software scene skipped: OpenSans.ttf didn't open" << std::endl;
+
+   int failures = runGoldenScenes(scenes, "golden", update, [](bool srgb)
+                                  { drawList.setSRGBTarget(srgb); });
+   softwareGlyphs.release();
+   softwareShaper.close();
+   GlyphCacheStats glyphStats = glyphCache.stats();
+   printf("glyph cache: %zu glyphs, %d pages, %zu of %zu bytes, %.0f%% occupied\n", glyphStats.glyphs, glyphStats.pages,
+          glyphStats.bytes, glyphStats.budget, glyphStats.occupancy * 100.0);
+   return failures;
+}
 
-   GLuint fontTexture;
-   glGenTextures(1, &fontTexture);
-   glBindTexture(GL_TEXTURE_2D, fontTexture);
-
-   // set texture params
-
-   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+// Offscreen replay of a frame capture: main.exe --replay capture.bin [frames].
+// It runs like a golden scene at the capture's pixel size, so the first replay
+// writes capture.png next to the file and later ones are compared with it.
+int runReplay(const char *path, int frames)
+{
+   FrameCapture capture;
+   if (!capture.load(path))
+      return -1;
+   std::vector<GLuint> textures = capture.createTextures();
 
-   // ortho
+   std::string directory = ".", name = path;
+   size_t slash = name.find_last_of("/\\");
+   if (slash != std::string::npos)
+   {
+      directory = name.substr(0, slash);
+      name = name.substr(slash + 1);
+   }
+   name = name.substr(0, name.find_last_of('.'));
 
+   // window units, like the view the frame was captured from
+   float w = (float)capture.width(), h = (float)capture.height();
    float ortho[16] = {
        2.0f / w, 0, 0, 0,
        0, -2.0f / h, 0, 0,
        0, 0, -1, 0,
        -1, 1, 0, 1};
+   GoldenScene scene = {name.c_str(), (int)std::lround(w * capture.scale()), (int)std::lround(h * capture.scale()),
+                        1e9, INT_MAX, [&](int drawableWidth, int)
+                        {
+                           capture.replay(drawList, clipStack, textures);
+                           submitFrame(ortho, drawableWidth);
+                        },
+                        frames};
+   printf("%s: %dx%d at %.2fx, %zu commands, %zu textures, %zu clips\n", path, capture.width(), capture.height(),
+          capture.scale(), capture.commands().size(), capture.textures().size(), capture.clips().size());
+   // the runner only writes references on request; a capture's first replay asks for one
+   FILE *reference = fopen((directory + "/" + name + ".png").c_str(), "rb");
+   if (reference)
+      fclose(reference);
+   int failures = runGoldenScenes({scene}, directory.c_str(), reference == nullptr, [](bool srgb)
+                                  { drawList.setSRGBTarget(srgb); });
+   printf("%d batches\n", drawList.batchCount());
+   glDeleteTextures((GLsizei)textures.size(), textures.data());
+   return failures;
+}
+
+// Headless replay of a frame capture: main.exe --replay-software capture.bin [frames] [out.png]
+// Images are left out; see FrameCapture::replay.
+int replaySoftware(const char *path, int frames, const char *outputPath)
+{
+   FrameCapture capture;
+   if (!capture.load(path))
+      return -1;
+   int w = (int)std::lround(capture.width() * capture.scale());
+   int h = (int)std::lround(capture.height() * capture.scale());
 
-   // upload the texture data
+   SoftwareRenderer renderer;
+   std::vector<double> times;
+   int skipped = 0;
+   for (int i = 0; i < std::max(frames, 1); i++)
+   {
+      Uint64 start = SDL_GetPerformanceCounter();
+      renderer.begin(w, h, 0.12f, 0.12f, 0.12f);
+      skipped = capture.replay(renderer);
+      renderer.finish();
+      times.push_back((SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency());
+   }
+   std::sort(times.begin(), times.end());
+   printf("%s: %dx%d, %zu commands (%d skipped), %zu frames: median %.3f ms, min %.3f, max %.3f\n", path, w, h,
+          capture.commands().size(), skipped, times.size(), times[times.size() / 2], times.front(), times.back());
+
+   if (!outputPath)
+      return 0;
+   SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom((void *)renderer.pixels(), w, h, 32, w * 4,
+                                                             SDL_PIXELFORMAT_ABGR8888);
+   int result = 0;
+   if (!surface || IMG_SavePNG(surface, outputPath) != 0)
+   {
+      std::cerr << "Failed to write " << outputPath << ": " << SDL_GetError() << std::endl;
+      result = -1;
+   }
+   if (surface)
+      SDL_FreeSurface(surface);
+   return result;
+}
 
-   SDL_Surface *formattedSurface = SDL_ConvertSurfaceFormat(textSurface, SDL_PIXELFORMAT_ABGR8888, 0);
-   if (!formattedSurface)
+// Headless frame through the software rasterizer: main.exe --software out.png [file]
+// Icons are left out; they only exist as GL textures.
+int renderSoftware(const char *outputPath, const char *documentPath, int w, int h)
+{
+   if (TTF_Init() == -1)
    {
-      std::cerr << "Surface format conversion failed: " << SDL_GetError() << std::endl;
+      std::cerr << "TTF_Init failed: " << TTF_GetError() << std::endl;
+      return -1;
    }
 
-   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
-                formattedSurface->w, formattedSurface->h, 0,
-                GL_RGBA, GL_UNSIGNED_BYTE, formattedSurface->pixels);
-
-   float textX = x, textY = y;
-   float textW = (float)textSurface->w;
-   float textH = (float)textSurface->h;
-
-   float quadVertices[] = {
-       // pos      // tex
-       textX, textY + textH, 0.0f, 1.0f,
-       textX, textY, 0.0f, 0.0f,
-       textX + textW, textY, 1.0f, 0.0f,
-
-       textX, textY + textH, 0.0f, 1.0f,
-       textX + textW, textY, 1.0f, 0.0f,
-       textX + textW, textY + textH, 1.0f, 1.0f};
-
-   GLuint textVAO, textVBO;
-   glGenVertexArrays(1, &textVAO);
-   glGenBuffers(1, &textVBO);
-   glBindVertexArray(textVAO);
-
-   glBindBuffer(GL_ARRAY_BUFFER, textVBO);
-   glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), quadVertices, GL_STATIC_DRAW);
-
-   // position
-   glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
-   glEnableVertexAttribArray(0);
-   // tex coords
-   glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)(2 * sizeof(float)));
-   glEnableVertexAttribArray(1);
-
-   glUniform1i(glGetUniformLocation(textShaderProgram, "uTexture"), 0);
-   glUseProgram(textShaderProgram);
-   glUniformMatrix4fv(glGetUniformLocation(textShaderProgram, "uProjection"), 1, GL_FALSE, ortho);
-   glActiveTexture(GL_TEXTURE0);
-   glEnable(GL_BLEND);
-   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-   // glBindTexture(GL_TEXTURE_2D, fontTexture);
-   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-
-   glBindTexture(GL_TEXTURE_2D, fontTexture);
-   glBindVertexArray(textVAO);
-   glDrawArrays(GL_TRIANGLES, 0, 6);
-
-   SDL_FreeSurface(textSurface);
-   SDL_FreeSurface(formattedSurface);
-   glDeleteTextures(1, &fontTexture);
-   TTF_CloseFont(font);
-
-   glDeleteVertexArrays(1, &textVAO);
-   glDeleteBuffers(1, &textVBO);
+   int result = 0;
+   {
+      GlyphCache glyphs;
+      Shaper shaper;
+      ShapeCache shapeCache(shaper, 0);
+      SoftwareRenderer renderer;
+      Document document;
+      Highlighter highlighter(document);
+      if (!glyphs.init("OpenSans.ttf", 24) || !shaper.open("OpenSans.ttf", 24))
+         result = -1;
+      glyphs.setShaping(&shapeCache);
+
+      renderer.begin(w, h, 0.12f, 0.12f, 0.12f);
+      SDL_Color textColor = {255, 255, 255, 255};
+      if (documentPath && document.open(documentPath))
+      {
+         bool highlight = isSourceFile(documentPath);
+         std::vector<std::string> lines;
+         document.lines(0, (size_t)((h - barHeight) / lineHeight) + 1, lines, 256);
+         for (size_t i = 0; i < lines.size(); i++)
+            renderer.drawText(glyphs, lines[i], 20.0f, barHeight + i * lineHeight, textColor,
+                              highlight ? &highlighter.spans(i) : nullptr, tokenColor);
+      }
 
-   return 0;
+      // the bar goes over the page, shadow included, as drawTopBar layers it
+      renderer.drawRect(0.0f, 0.0f, (float)w, barHeight, barStyle);
+      for (const MenuItem &item : menuItems)
+         renderer.drawText(glyphs, item.label, item.x + iconSize + 4.0f, 2.0f, textColor);
+      renderer.finish();
+
+      SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom((void *)renderer.pixels(), w, h, 32, w * 4,
+                                                                SDL_PIXELFORMAT_ABGR8888);
+      if (!surface || IMG_SavePNG(surface, outputPath) != 0)
+      {
+         std::cerr << "Failed to write " << outputPath << ": " << SDL_GetError() << std::endl;
+         result = -1;
+      }
+      if (surface)
+         SDL_FreeSurface(surface);
+      glyphs.release();
+      shaper.close();
+   }
+   TTF_Quit();
+   return result;
 }
 
-int main()
+// One window onto the document, scrolled on its own
+struct DocumentView
+{
+   SDL_Window *window = nullptr;
+   WindowState state;
+   uint64_t layoutGeneration = 0;
+   size_t visibleLines = 0;
+   size_t firstLine = 0;
+   size_t prefetchedLine = Document::npos;
+   int hoveredItem = -1;
+};
+
+// How long an idle loop sleeps before checking background work again
+const Uint32 idleWaitMs = 100;
+
+int main(int argc, char *argv[])
 {
+   StartupTimeline startup;
+   if (argc > 2 && strcmp(argv[1], "--software") == 0)
+      return renderSoftware(argv[2], argc > 3 ? argv[3] : nullptr, 800, 600);
+   if (argc > 2 && strcmp(argv[1], "--replay-software") == 0)
+      return replaySoftware(argv[2], argc > 3 ? atoi(argv[3]) : 30, argc > 4 ? argv[4] : nullptr);
+
+   double phase = startup.now();
    if (SDL_Init(SDL_INIT_VIDEO) < 0)
    {
       std::cerr << "SDL init failed: " << SDL_GetError() << std::endl;
       return -1;
    }
-
+   if (TTF_Init() == -1)
+   {
+      std::cerr << "TTF_Init failed: " << TTF_GetError() << std::endl;
+      SDL_Quit();
+      return -1;
+   }
+   startup.record("sdl init", phase);
+
+   // Fonts and icons don't need the window: they load on workers while the
+   // window and GL context are created. Nothing else touches SDL_ttf until
+   // the font loader is joined.
+   Shaper shaper;
+   std::thread fontLoader([&]()
+                          {
+                             double start = startup.now();
+                             glyphCache.init("OpenSans.ttf", 24);
+                             // text is shaped once per distinct string; lines near the viewport are shaped ahead on workers
+                             shaper.open("OpenSans.ttf", 24);
+                             startup.record("fonts", start); });
+   // Toolbar icons come from the image cache's shared atlas; asking for them starts their decodes
+   phase = startup.now();
+   ImageCache imageCache(textureUploader);
+   for (const MenuItem &item : menuItems)
+      imageCache.get(item.icon);
+   startup.record("queue icon decodes", phase);
+
+   phase = startup.now();
+   bool golden = argc > 1 && strcmp(argv[1], "--golden") == 0;
+   bool replay = argc > 2 && strcmp(argv[1], "--replay") == 0;
+   bool offscreen = golden || replay;
+   // lets text blend in linear space; the draw list is told what the driver actually gave
+   SDL_GL_SetAttribute(SDL_GL_FRAMEBUFFER_SRGB_CAPABLE, 1);
    SDL_Window *window = SDL_CreateWindow("Top File Bar",
                                          SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-                                         800, 600, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
+                                         800, 600, SDL_WINDOW_OPENGL | SDL_WINDOW_ALLOW_HIGHDPI |
+                                             (offscreen ? SDL_WINDOW_HIDDEN : SDL_WINDOW_RESIZABLE));
 
    if (!window)
    {
       std::cerr << "Window creation failed: " << SDL_GetError() << std::endl;
+      fontLoader.join();
+      imageCache.shutdown();
       SDL_Quit();
       return -1;
    }
+   startup.record("window", phase);
 
+   phase = startup.now();
    SDL_GLContext context = SDL_GL_CreateContext(window);
    if (!context)
    {
       std::cerr << "GL context failed: " << SDL_GetError() << std::endl;
+      fontLoader.join();
       SDL_DestroyWindow(window);
+      imageCache.shutdown();
       SDL_Quit();
       return -1;
    }
+   startup.record("gl context", phase);
 
+   // the trimmed loader resolves only what the engine calls up front
+   phase = startup.now();
    if (!gladLoadGLLoader((GLADloadproc)SDL_GL_GetProcAddress))
    {
       std::cerr << "GLAD init failed." << std::endl;
+      fontLoader.join();
       SDL_GL_DeleteContext(context);
       SDL_DestroyWindow(window);
+      imageCache.shutdown();
       SDL_Quit();
       return -1;
    }
+   startup.record("gl loader", phase);
+
+   // issued now, checked last, so the driver compiles while the rest is set up
+   phase = startup.now();
+   PendingProgram rectProgram = startProgram(vertexShaderSource, fragmentShaderSource);
+   PendingProgram textProgram = startProgram(textVertexShaderSource, textFragmentShaderSource);
+   startup.record("issue shaders", phase);
+
+   // frames start as late as they can and still make the vblank; ENGINE_PRESENT=uncapped for benchmarks
+   phase = startup.now();
+   FrameScheduler scheduler;
+   scheduler.init(window, presentModeFromEnvironment(PRESENT_ADAPTIVE));
+
+   textureUploader.init();
+   textureUploader.setFrameBudget(2 * 1024 * 1024);
+   startup.record("pacing and uploads", phase);
+
+   phase = startup.now();
+   fontLoader.join();
+   startup.record("wait for fonts", phase);
+   phase = startup.now();
+   glyphCache.setBudget(8 * 1024 * 1024);
+   ShapeCache shapeCache(shaper);
+   glyphCache.setShaping(&shapeCache);
+   int logicalWidth = 0, pixelWidth = 0;
+   SDL_GetWindowSize(window, &logicalWidth, nullptr);
+   SDL_GL_GetDrawableSize(window, &pixelWidth, nullptr);
+   glyphCache.setScale(logicalWidth ? (float)pixelWidth / logicalWidth : 1.0f);
+   prewarmTopBar();
+   startup.record("prewarm menu glyphs", phase);
+
+   phase = startup.now();
+   GLuint shaderProgram = finishProgram(rectProgram);
+   GLuint textShaderProgram = finishProgram(textProgram);
+   // ENGINE_VERTEX=float streams 32-bit floats instead of the packed formats
+   drawList.init(shaderProgram, textShaderProgram, vertexFormatFromEnvironment(VERTEX_COMPACT));
+   // every window is made with the same attributes, so the default framebuffer is asked about once
+   drawList.setSRGBTarget(DrawList::framebufferIsSRGB());
+   drawList.setClipStack(&clipStack);
+   startup.record("finish shaders", phase);
+
+   // File loading: a path on the command line or a file dropped on a window
+   Document document;
+   Highlighter highlighter(document);
+   bool highlight = false;
+   size_t highlightFrontier = 0;
+
+   // Caret as a line and a byte column, shared by every view of the document
+   size_t caretLine = 0, caretColumn = 0;
+
+   // Every window is a view of the document drawn with the one context, so the
+   // atlases, programs and buffers exist once however many are open. The first
+   // window made the context; closing it only hides it.
+   std::vector<std::unique_ptr<DocumentView>> views;
+   auto damageAll = [&]()
+   {
+      for (auto &view : views)
+         view->state.damage();
+   };
+   auto viewOf = [&](Uint32 windowID) -> DocumentView *
+   {
+      for (auto &view : views)
+         if (view->state.id() == windowID)
+            return view.get();
+      return nullptr;
+   };
 
-   SDL_GL_SetSwapInterval(1); // Enable vsync
+   auto openDocument = [&](const char *path)
+   {
+      if (!document.open(path))
+         return;
+      caretLine = caretColumn = 0;
+      for (auto &view : views)
+      {
+         view->firstLine = 0;
+         view->prefetchedLine = Document::npos;
+      }
+      highlight = isSourceFile(path);
+      highlighter.reset();
+      damageAll();
+   };
 
-   GLuint shaderProgram = createShaderProgram();
+   auto insertAtCaret = [&](const std::string &text)
+   {
+      size_t offset = document.lineOffset(caretLine);
+      if (offset == Document::npos)
+         return;
+      document.insert(offset + caretColumn, text);
+
+      size_t newlines = std::count(text.begin(), text.end(), '\n');
+      if (highlight)
+         highlighter.edited(caretLine, 0, newlines);
+      if (newlines)
+      {
+         caretLine += newlines;
+         caretColumn = text.size() - text.find_last_of('\n') - 1;
+      }
+      else
+         caretColumn += text.size();
+   };
 
-   bool running = true;
-   SDL_Event event;
+   auto backspaceAtCaret = [&]()
+   {
+      size_t offset = document.lineOffset(caretLine);
+      if (offset == Document::npos)
+         return;
+      if (caretColumn > 0)
+      {
+         // step back over a whole UTF-8 sequence
+         std::string line = document.line(caretLine, caretColumn);
+         size_t start = caretColumn - 1;
+         while (start > 0 && ((unsigned char)line[start] & 0xC0) == 0x80)
+            start--;
+         document.erase(offset + start, caretColumn - start);
+         caretColumn = start;
+         if (highlight)
+            highlighter.edited(caretLine, 0, 0);
+      }
+      else if (caretLine > 0)
+      {
+         // a CRLF terminator goes as a whole; line() has already dropped its CR
+         size_t terminator = offset >= 2 && document.text(offset - 2, 1) == "\r" ? 2 : 1;
+         caretColumn = document.line(caretLine - 1, (size_t)-1).size();
+         document.erase(offset - terminator, terminator);
+         caretLine--;
+         if (highlight)
+            highlighter.edited(caretLine, 1, 0);
+      }
+   };
 
-   while (running)
+   int exitCode = 0;
+   if (golden)
    {
-      while (SDL_PollEvent(&event))
+      startup.print();
+      exitCode = runGolden(imageCache, argc > 2 && strcmp(argv[2], "--update") == 0);
+   }
+   else if (replay)
+      exitCode = runReplay(argv[2], argc > 3 ? atoi(argv[3]) : 0);
+
+   // F12 captures the next frame drawn; ENGINE_CAPTURE_SLOW_MS=ms captures any
+   // frame that took longer to record, at most one a second. Both are written
+   // to capture-<ticks>.bin for --replay.
+   FrameCapture frameCapture;
+   bool captureNext = false;
+   const char *slowSetting = getenv("ENGINE_CAPTURE_SLOW_MS");
+   double slowFrameMs = slowSetting ? atof(slowSetting) : 0.0;
+   Uint32 lastSlowCapture = 0;
+
+   // Records one view; the window's size and projection come from its event
+   // watch, and what depends on them is rebuilt once per frame at the latest size.
+   // False when something drawn was still on its way and the view needs another frame
+   auto renderView = [&](DocumentView &view) -> bool
+   {
+      int w = view.state.width(), h = view.state.height();
+      // viewport and glyph scale belong to the context, which the other windows share
+      glViewport(0, 0, view.state.drawableWidth(), view.state.drawableHeight());
+      // layout stays in window units; glyphs are rasterized for the pixels behind them
+      glyphCache.setScale(view.state.scale());
+      if (view.state.generation() != view.layoutGeneration)
       {
-         if (event.type == SDL_QUIT)
-            running = false;
+         view.visibleLines = (size_t)((h - barHeight) / lineHeight) + 1;
+         view.prefetchedLine = Document::npos;
+         view.layoutGeneration = view.state.generation();
       }
 
-      int w, h;
-      SDL_GetWindowSize(window, &w, &h);
+      bool complete = drawTopBar(imageCache, w, view.hoveredItem);
+      SDL_Color textColor = {255, 255, 255, 255}; // white text
 
-      // Projection matrix (Orthographic)
-      float ortho[16] = {
-          2.0f / w, 0, 0, 0,
-          0, -2.0f / h, 0, 0,
-          0, 0, -1, 0,
-          -1, 1, 0, 1};
+      // Only the lines in view are read, so only their pages of the mapping get touched
+      if (document.isOpen())
+      {
+         // long lines run off the right edge; their hidden glyphs are dropped before the batch
+         clipStack.push(0.0f, barHeight, (float)w, h - barHeight);
+
+         size_t firstLine = view.firstLine, visibleLines = view.visibleLines;
+         std::vector<std::string> lines;
+         document.lines(firstLine, visibleLines, lines, 256);
+
+         // a screen either side, so scrolling finds its lines already shaped
+         if (firstLine != view.prefetchedLine)
+         {
+            std::vector<std::string> nearby;
+            document.lines(firstLine > visibleLines ? firstLine - visibleLines : 0, visibleLines * 3, nearby, 256);
+            for (const std::string &line : nearby)
+               shapeCache.prefetch(line);
+            view.prefetchedLine = firstLine;
+         }
+         for (size_t i = 0; i < lines.size(); i++)
+         {
+            const std::vector<TokenSpan> *spans = highlight ? &highlighter.spans(firstLine + i) : nullptr;
+            if (!lines[i].empty())
+               renderText(lines[i], 20.0f, barHeight + i * lineHeight, textColor, spans);
+         }
+
+         if (caretLine >= firstLine && caretLine - firstLine < lines.size())
+         {
+            float caretX = glyphCache.measure(lines[caretLine - firstLine], caretColumn);
+            float caretY = barHeight + (caretLine - firstLine) * lineHeight + lineHeight / 2.0f + 2.0f;
+            drawRectangle(20.0f + caretX, caretY, 2.0f, lineHeight - 4.0f, 0.9f, 0.9f, 0.9f);
+         }
+         clipStack.pop();
+      }
+      submitFrame(view.state.projection(), view.state.drawableWidth());
+      return complete;
+   };
 
-      glViewport(0, 0, w, h);
-      glClearColor(0.12f, 0.12f, 0.12f, 1.0f); // dark bg
-      glClear(GL_COLOR_BUFFER_BIT);
+   // Draws damaged views in turn; only the last waits for the vblank
+   auto renderFrame = [&](const std::vector<DocumentView *> &drawing)
+   {
+      for (size_t i = 0; i < drawing.size(); i++)
+      {
+         DocumentView &view = *drawing[i];
+         SDL_GL_MakeCurrent(view.window, context);
+         view.state.clearDamage();
+         // a slow frame is only known afterwards, so with the setting on every frame is collected
+         bool capturing = captureNext || slowFrameMs > 0.0;
+         if (capturing)
+         {
+            frameCapture.begin(view.state.width(), view.state.height(), view.state.scale());
+            drawList.setCapture(&frameCapture);
+         }
+         Uint64 start = SDL_GetPerformanceCounter();
+         if (!renderView(view))
+            view.state.damage();
+         double elapsedMs = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+         if (capturing)
+         {
+            drawList.setCapture(nullptr);
+            bool slow = slowFrameMs > 0.0 && elapsedMs > slowFrameMs &&
+                        (lastSlowCapture == 0 || SDL_GetTicks() - lastSlowCapture >= 1000);
+            if (captureNext || slow)
+            {
+               // before the atlases change under the commands
+               frameCapture.end();
+               std::string path = "capture-" + std::to_string(SDL_GetTicks()) + ".bin";
+               if (frameCapture.save(path))
+                  printf("captured a %.2f ms frame to %s: %zu commands, %zu textures\n", elapsedMs, path.c_str(),
+                         frameCapture.commands().size(), frameCapture.textures().size());
+               if (slow)
+                  lastSlowCapture = SDL_GetTicks();
+               captureNext = false;
+            }
+         }
+         if (i + 1 < drawing.size())
+            scheduler.swapUnsynced(view.window);
+         else
+            scheduler.present(view.window);
+      }
 
-      glUseProgram(shaderProgram);
-      glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "uProjection"), 1, GL_FALSE, ortho);
+      // refilled glyphs and deferred uploads show up in a later frame
+      bool settled = !glyphCache.refilling() && textureUploader.pendingBytes() == 0;
+      glyphCache.endFrame();
+      textureUploader.endFrame();
+      startup.firstFrame();
+      if (!settled)
+         for (DocumentView *view : drawing)
+            view->state.damage();
+   };
+
+   auto openView = [&](SDL_Window *target)
+   {
+      views.push_back(std::make_unique<DocumentView>());
+      DocumentView *view = views.back().get();
+      view->window = target;
+      view->state.attach(target);
+      // the OS may hold the main loop in a modal resize loop; the watch draws then
+      view->state.setLiveResize([&, view]()
+                                { renderFrame({view}); });
+   };
+   auto closeView = [&](DocumentView *view)
+   {
+      view->state.detach();
+      if (view->window == window)
+         SDL_HideWindow(window);
+      else
+         SDL_DestroyWindow(view->window);
+      views.erase(std::find_if(views.begin(), views.end(), [view](const std::unique_ptr<DocumentView> &open)
+                               { return open.get() == view; }));
+   };
+   auto newWindow = [&]()
+   {
+      SDL_Window *tool = SDL_CreateWindow("Top File Bar", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 800, 600,
+                                          SDL_WINDOW_OPENGL | SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_RESIZABLE);
+      if (!tool)
+      {
+         std::cerr << "Window creation failed: " << SDL_GetError() << std::endl;
+         return;
+      }
+      openView(tool);
+   };
 
-      // Render top bar (stretching full width of screen)
-      float barHeight = 40.0f; // Height of top bar
-      drawRectangle(shaderProgram, w / 2.0f, barHeight / 2.0f, (float)w, barHeight, 0.3f, 0.3f, 0.35f);
+   if (!offscreen)
+   {
+      openView(window);
+      // ENGINE_WINDOWS=n opens n windows on the document; Ctrl+N opens more
+      const char *count = getenv("ENGINE_WINDOWS");
+      for (int i = 1; count && i < atoi(count); i++)
+         newWindow();
+      if (argc > 1)
+         openDocument(argv[1]);
+   }
 
-      glDrawArrays(GL_TRIANGLES, 0, 6);
-      SDL_Color textColor = {255, 255, 255, 255}; // white text
-      renderText(window, &context, (float)w, (float)h, "File", 20.0f, 2.0f, textColor);
-      renderText(window, &context, (float)w, (float)h, "Edit", 80.0f, 2.0f, textColor);
+   bool running = !offscreen;
+   // drained in bulk each frame; pointer motion arrives as one event per run
+   InputQueue input;
+
+   while (running)
+   {
+      scheduler.waitForFrame();
+      WindowState::beginPump();
+      input.pump();
+      WindowState::endPump();
+      for (const SDL_Event &event : input.events())
+      {
+         if (event.type == SDL_TEXTINPUT || event.type == SDL_KEYDOWN || event.type == SDL_MOUSEWHEEL ||
+             event.type == SDL_MOUSEMOTION)
+            scheduler.inputReceived(event.common.timestamp);
 
-      SDL_GL_SwapWindow(window);
+         if (event.type == SDL_QUIT)
+            running = false;
+         else if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE)
+         {
+            if (DocumentView *view = viewOf(event.window.windowID))
+               closeView(view);
+            running = !views.empty();
+         }
+         else if (event.type == SDL_DROPFILE)
+         {
+            openDocument(event.drop.file);
+            SDL_free(event.drop.file);
+         }
+         else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_n && (event.key.keysym.mod & KMOD_CTRL))
+            newWindow();
+         else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F12)
+         {
+            captureNext = true;
+            if (DocumentView *view = viewOf(event.key.windowID))
+               view->state.damage();
+         }
+         else if (event.type == SDL_TEXTINPUT && document.isOpen())
+         {
+            insertAtCaret(event.text.text);
+            damageAll();
+         }
+         else if (event.type == SDL_KEYDOWN && document.isOpen())
+         {
+            size_t lineCount = document.lineCount();
+            switch (event.key.keysym.sym)
+            {
+            case SDLK_RETURN:
+               insertAtCaret("\n");
+               break;
+            case SDLK_BACKSPACE:
+               backspaceAtCaret();
+               break;
+            case SDLK_LEFT:
+               // over a whole UTF-8 sequence, like backspace
+               if (caretColumn > 0)
+               {
+                  std::string line = document.line(caretLine, caretColumn);
+                  caretColumn--;
+                  while (caretColumn > 0 && ((unsigned char)line[caretColumn] & 0xC0) == 0x80)
+                     caretColumn--;
+               }
+               break;
+            case SDLK_RIGHT:
+            {
+               std::string line = document.line(caretLine, (size_t)-1);
+               if (caretColumn < line.size())
+                  caretColumn++;
+               while (caretColumn < line.size() && ((unsigned char)line[caretColumn] & 0xC0) == 0x80)
+                  caretColumn++;
+               break;
+            }
+            case SDLK_UP:
+               if (caretLine > 0)
+                  caretLine--;
+               break;
+            case SDLK_DOWN:
+               if (caretLine + 1 < lineCount)
+                  caretLine++;
+               break;
+            }
+            std::string caretText = document.line(caretLine, (size_t)-1);
+            caretColumn = std::min(caretColumn, caretText.size());
+            // a column carried over from another line can fall inside a character
+            while (caretColumn > 0 && caretColumn < caretText.size() &&
+                   ((unsigned char)caretText[caretColumn] & 0xC0) == 0x80)
+               caretColumn--;
+            damageAll();
+         }
+         else if (event.type == SDL_MOUSEMOTION)
+         {
+            DocumentView *view = viewOf(event.motion.windowID);
+            int hovered = menuItemAt(event.motion.x, event.motion.y);
+            if (view && hovered != view->hoveredItem)
+            {
+               view->hoveredItem = hovered;
+               view->state.damage();
+            }
+         }
+         else if (event.type == SDL_MOUSEWHEEL && document.isOpen())
+         {
+            DocumentView *view = viewOf(event.wheel.windowID);
+            if (!view)
+               continue;
+            long long target = (long long)view->firstLine - event.wheel.y * 3;
+            long long last = (long long)document.lineCount() - 1;
+            size_t firstLine = (size_t)std::max(0LL, std::min(target, last));
+            if (firstLine != view->firstLine)
+            {
+               view->firstLine = firstLine;
+               view->state.damage();
+            }
+         }
+      }
+
+      // once per frame whatever the number of windows; spans the worker finished repaint the views
+      if (highlight && document.isOpen())
+      {
+         highlighter.update();
+         if (highlighter.frontier() != highlightFrontier)
+         {
+            highlightFrontier = highlighter.frontier();
+            damageAll();
+         }
+      }
+
+      std::vector<DocumentView *> drawing;
+      for (auto &view : views)
+         if (view->state.damaged())
+            drawing.push_back(view.get());
+      if (drawing.empty())
+      {
+         // nothing changed: sleep until something happens instead of redrawing the same pixels
+         scheduler.skipFrame();
+         WindowState::beginPump();
+         SDL_WaitEventTimeout(nullptr, idleWaitMs);
+         WindowState::endPump();
+         continue;
+      }
+      renderFrame(drawing);
+
+      LatencyReport latency;
+      if (scheduler.report(latency))
+         printf("input to swap: %.1f ms average, %.1f ms worst over %d events; render %.2f ms, %d missed frames\n",
+                latency.averageMs, latency.worstMs, latency.inputs, latency.renderMs, latency.missed);
    }
 
+   // GL resources are released with the context current on the window that made it
+   for (auto &view : views)
+      view->state.detach();
+   SDL_GL_MakeCurrent(window, context);
+   glyphCache.setShaping(nullptr);
+   glyphCache.release();
+   shapeCache.shutdown();
+   shaper.close();
    TTF_Quit();
+   drawList.release();
+   imageCache.release();
+   textureUploader.release();
+   glDeleteProgram(textShaderProgram);
    glDeleteProgram(shaderProgram);
 
    SDL_GL_DeleteContext(context);
+   for (auto &view : views)
+      if (view->window != window)
+         SDL_DestroyWindow(view->window);
+   views.clear();
    SDL_DestroyWindow(window);
    SDL_Quit();
-   return 0;
+   return exitCode;
 }
@@ -0,0 +1,152 @@
+#include "pacing.h"
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+PresentMode presentModeFromEnvironment(PresentMode fallback)
+{
+   const char *forced = getenv("ENGINE_PRESENT");
+   if (!forced)
+      return fallback;
+   if (strcmp(forced, "vsync") == 0)
+      return PRESENT_VSYNC;
+   if (strcmp(forced, "adaptive") == 0)
+      return PRESENT_ADAPTIVE;
+   if (strcmp(forced, "uncapped") == 0)
+      return PRESENT_UNCAPPED;
+   std::cerr << "Unknown ENGINE_PRESENT " << forced << ", using the default" << std::endl;
+   return fallback;
+}
+
+void FrameScheduler::init(SDL_Window *target, PresentMode mode)
+{
+   window = target;
+   frequency = SDL_GetPerformanceFrequency() / 1000.0;
+   presentMode = mode;
+   if (mode == PRESENT_ADAPTIVE && SDL_GL_SetSwapInterval(-1) != 0)
+   {
+      std::cerr << "Adaptive vsync unavailable (" << SDL_GetError() << "), using vsync" << std::endl;
+      presentMode = PRESENT_VSYNC;
+   }
+   if (presentMode == PRESENT_VSYNC && SDL_GL_SetSwapInterval(1) != 0)
+   {
+      std::cerr << "Vsync unavailable: " << SDL_GetError() << std::endl;
+      presentMode = PRESENT_UNCAPPED;
+   }
+   if (presentMode == PRESENT_UNCAPPED)
+      SDL_GL_SetSwapInterval(0);
+   interval = presentMode == PRESENT_ADAPTIVE ? -1 : presentMode == PRESENT_VSYNC ? 1 : 0;
+
+   SDL_DisplayMode display;
+   if (SDL_GetWindowDisplayMode(window, &display) == 0 && display.refresh_rate > 0)
+      period = 1000.0 / display.refresh_rate;
+
+   costs.assign(kHistory, period / 4.0);
+   nextCost = 0;
+   margin = kMinMarginMs;
+   lastPresent = frameStart = now();
+   lastReport = SDL_GetTicks();
+}
+
+double FrameScheduler::now() const
+{
+   return SDL_GetPerformanceCounter() / frequency;
+}
+
+// Most frames cost about the same; a high percentile absorbs the odd slow one without chasing outliers
+double FrameScheduler::predictedCost()
+{
+   sorted = costs;
+   size_t rank = (size_t)(kPercentile * (sorted.size() - 1));
+   std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+   return sorted[rank];
+}
+
+void FrameScheduler::waitForFrame()
+{
+   if (presentMode != PRESENT_UNCAPPED)
+   {
+      double deadline = lastPresent + period;
+      double wake = deadline - predictedCost() - margin;
+      // SDL_Delay oversleeps by up to a millisecond; spin out the rest
+      double remaining = wake - now();
+      if (remaining > 2.0)
+         SDL_Delay((Uint32)(remaining - 1.5));
+      while (now() < wake)
+         ;
+   }
+   frameStart = now();
+}
+
+void FrameScheduler::inputReceived(Uint32 timestamp)
+{
+   pendingInputs.push_back(timestamp);
+}
+
+void FrameScheduler::swapUnsynced(SDL_Window *target)
+{
+   if (interval != 0)
+      SDL_GL_SetSwapInterval(0);
+   SDL_GL_SwapWindow(target);
+   if (interval != 0)
+      SDL_GL_SetSwapInterval(interval);
+}
+
+void FrameScheduler::skipFrame()
+{
+   // input that changed nothing on screen has no latency to measure
+   pendingInputs.clear();
+   resumed = true;
+}
+
+void FrameScheduler::present(SDL_Window *target)
+{
+   double submitted = now();
+   SDL_GL_SwapWindow(target ? target : window);
+   if (presentMode != PRESENT_UNCAPPED)
+      glFinish();
+   double presented = now();
+
+   costs[nextCost] = submitted - frameStart;
+   nextCost = (nextCost + 1) % costs.size();
+
+   // a frame spanning more than one refresh missed its vblank, unless the ones before it were skipped
+   if (presentMode != PRESENT_UNCAPPED && !resumed)
+   {
+      if (presented - lastPresent > period * 1.5)
+      {
+         missedFrames++;
+         margin = std::min(margin + 1.0, period / 2.0);
+      }
+      else
+         margin = std::max(margin - 0.05, kMinMarginMs);
+   }
+   lastPresent = presented;
+   resumed = false;
+
+   Uint32 ticks = SDL_GetTicks();
+   for (Uint32 timestamp : pendingInputs)
+   {
+      double latency = (double)(ticks - timestamp);
+      latencySum += latency;
+      latencyWorst = std::max(latencyWorst, latency);
+      latencyCount++;
+   }
+   pendingInputs.clear();
+}
+
+bool FrameScheduler::report(LatencyReport &out)
+{
+   Uint32 ticks = SDL_GetTicks();
+   if (ticks - lastReport < kReportIntervalMs)
+      return false;
+   lastReport = ticks;
+   bool any = latencyCount > 0;
+   out = {latencyCount, any ? latencySum / latencyCount : 0.0, latencyWorst, predictedCost(), missedFrames};
+   latencySum = latencyWorst = 0.0;
+   latencyCount = missedFrames = 0;
+   return any;
+}
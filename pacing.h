@@ -0,0 +1,94 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <SDL2/SDL.h>
+#include <cstdint>
+#include <vector>
+
+enum PresentMode
+{
+   PRESENT_VSYNC,    // swap interval 1
+   PRESENT_ADAPTIVE, // swap interval -1: late frames tear instead of waiting a whole refresh
+   PRESENT_UNCAPPED  // swap interval 0, no waiting; for benchmarking
+};
+
+struct LatencyReport
+{
+   int inputs;       // input events presented since the last report
+   double averageMs; // from the event being queued to its frame's swap returning
+   double worstMs;
+   double renderMs;  // predicted render cost the schedule is built around
+   int missed;       // frames that took more than one refresh
+};
+
+// Paces frames so input is read as late as possible. Rendering right after
+// the previous swap means an event arriving just after the poll waits out
+// nearly a whole refresh; instead the scheduler predicts this frame's cost
+// from a high percentile of recent ones and sleeps until that long (plus a
+// margin) before the next vblank, then lets the caller poll and render.
+// Missed deadlines widen the margin, and on-time frames slowly narrow it.
+// present() waits for the flip so the next deadline is measured from the real
+// vblank and the driver can't queue frames ahead, each of which would add a
+// refresh of latency. ENGINE_PRESENT=vsync|adaptive|uncapped picks the mode.
+//
+// With several windows on one context only the last one drawn in a frame is
+// presented synced; the others swap without waiting, so a frame costs one
+// vblank however many windows it touched. A frame that draws nothing is
+// skipped, and the first frame after it isn't counted as missed.
+class FrameScheduler
+{
+public:
+   static constexpr int kHistory = 32;           // frames the cost is predicted from
+   static constexpr double kPercentile = 0.9;
+   static constexpr double kMinMarginMs = 1.0;
+   static constexpr Uint32 kReportIntervalMs = 5000;
+
+   // Sets the swap interval for the window's current context. Adaptive falls
+   // back to vsync where the driver doesn't support it.
+   void init(SDL_Window *window, PresentMode mode = PRESENT_ADAPTIVE);
+   PresentMode mode() const { return presentMode; }
+
+   // Sleep until the latest point this frame can start and still make the vblank
+   void waitForFrame();
+   // An input event about to be handled; its SDL timestamp starts the latency clock
+   void inputReceived(Uint32 timestamp);
+   // Swap, wait for the flip in synced modes, and account the frame; the
+   // window defaults to the one given to init
+   void present(SDL_Window *target = nullptr);
+   // Swap another window drawn this frame without waiting for its vblank
+   void swapUnsynced(SDL_Window *target);
+   // Nothing needed drawing this frame
+   void skipFrame();
+
+   // Fills in a report every kReportIntervalMs while there has been input
+   bool report(LatencyReport &out);
+
+private:
+   double now() const;
+   double predictedCost();
+
+   SDL_Window *window = nullptr;
+   PresentMode presentMode = PRESENT_VSYNC;
+   int interval = 1;     // swap interval the mode uses
+   bool resumed = false; // the last frame was skipped
+   double period = 1000.0 / 60.0; // ms
+   double frequency = 1.0;        // performance counter ticks per ms
+   double lastPresent = 0.0;
+   double frameStart = 0.0;
+   double margin = kMinMarginMs;
+
+   std::vector<double> costs; // ring of recent render times
+   size_t nextCost = 0;
+   std::vector<double> sorted;
+
+   std::vector<Uint32> pendingInputs; // timestamps waiting for this frame's swap
+   double latencySum = 0.0;
+   double latencyWorst = 0.0;
+   int latencyCount = 0;
+   int missedFrames = 0;
+   Uint32 lastReport = 0;
+};
+
+PresentMode presentModeFromEnvironment(PresentMode fallback);
+
+#endif
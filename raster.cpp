@@ -0,0 +1,501 @@
+#include "raster.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RASTER_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(RASTER_X86) && defined(__GNUC__)
+#define RASTER_AVX2 1
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+// -------- Scalar kernels --------
+
+// x / 255 rounded to nearest, exact for x <= 255 * 255
+static inline unsigned int div255(unsigned int x)
+{
+   x += 128;
+   return (x + (x >> 8)) >> 8;
+}
+
+static inline uint32_t blendPixel(uint32_t dst, uint32_t color, unsigned int alpha)
+{
+   uint32_t out = 0;
+   for (int shift = 0; shift < 32; shift += 8)
+   {
+      unsigned int s = (color >> shift) & 0xFF, d = (dst >> shift) & 0xFF;
+      out |= div255(s * alpha + d * (255 - alpha)) << shift;
+   }
+   return out;
+}
+
+static void fillScalar(uint32_t *dst, int count, uint32_t color)
+{
+   for (int i = 0; i < count; i++)
+      dst[i] = color;
+}
+
+static void blendScalar(uint32_t *dst, int count, uint32_t color)
+{
+   unsigned int alpha = color >> 24;
+   for (int i = 0; i < count; i++)
+      dst[i] = blendPixel(dst[i], color, alpha);
+}
+
+static void blendCoverageScalar(uint32_t *dst, const unsigned char *coverage, int count, uint32_t color)
+{
+   unsigned int alpha = color >> 24;
+   for (int i = 0; i < count; i++)
+      if (coverage[i])
+         dst[i] = blendPixel(dst[i], color, div255(coverage[i] * alpha));
+}
+
+// -------- SSE2 kernels: 4 pixels, two per register as 16-bit channels --------
+
+#ifdef RASTER_X86
+
+static inline __m128i div255Sse2(__m128i x)
+{
+   x = _mm_add_epi16(x, _mm_set1_epi16(128));
+   return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// src * a + dst * (255 - a), with a already broadcast to each pixel's channels
+static inline __m128i blendSse2(__m128i src, __m128i dst, __m128i alpha)
+{
+   __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+   return div255Sse2(_mm_add_epi16(_mm_mullo_epi16(src, alpha), _mm_mullo_epi16(dst, inverse)));
+}
+
+static void fillSse2(uint32_t *dst, int count, uint32_t color)
+{
+   __m128i pixels = _mm_set1_epi32((int)color);
+   int i = 0;
+   for (; i + 4 <= count; i += 4)
+      _mm_storeu_si128((__m128i *)(dst + i), pixels);
+   fillScalar(dst + i, count - i, color);
+}
+
+static void blendSse2(uint32_t *dst, int count, uint32_t color)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i src = _mm_unpacklo_epi8(_mm_set1_epi32((int)color), zero);
+   __m128i alpha = _mm_set1_epi16((short)(color >> 24));
+   int i = 0;
+   for (; i + 4 <= count; i += 4)
+   {
+      __m128i pixels = _mm_loadu_si128((const __m128i *)(dst + i));
+      __m128i lo = blendSse2(src, _mm_unpacklo_epi8(pixels, zero), alpha);
+      __m128i hi = blendSse2(src, _mm_unpackhi_epi8(pixels, zero), alpha);
+      _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+   }
+   blendScalar(dst + i, count - i, color);
+}
+
+static void blendCoverageSse2(uint32_t *dst, const unsigned char *coverage, int count, uint32_t color)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i src = _mm_unpacklo_epi8(_mm_set1_epi32((int)color), zero);
+   __m128i colorAlpha = _mm_set1_epi16((short)(color >> 24));
+   int i = 0;
+   for (; i + 4 <= count; i += 4)
+   {
+      int bytes;
+      memcpy(&bytes, coverage + i, 4);
+      if (bytes == 0)
+         continue;
+      __m128i alpha = div255Sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), colorAlpha));
+      alpha = _mm_unpacklo_epi16(alpha, alpha);
+
+      __m128i pixels = _mm_loadu_si128((const __m128i *)(dst + i));
+      __m128i lo = blendSse2(src, _mm_unpacklo_epi8(pixels, zero), _mm_unpacklo_epi32(alpha, alpha));
+      __m128i hi = blendSse2(src, _mm_unpackhi_epi8(pixels, zero), _mm_unpackhi_epi32(alpha, alpha));
+      _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+   }
+   blendCoverageScalar(dst + i, coverage + i, count - i, color);
+}
+
+#endif
+
+// -------- AVX2 kernels: 8 pixels; unpacks stay within 128-bit lanes --------
+
+#ifdef RASTER_AVX2
+
+AVX2_TARGET static inline __m256i div255Avx2(__m256i x)
+{
+   x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+   return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+AVX2_TARGET static inline __m256i blendAvx2(__m256i src, __m256i dst, __m256i alpha)
+{
+   __m256i inverse = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+   return div255Avx2(_mm256_add_epi16(_mm256_mullo_epi16(src, alpha), _mm256_mullo_epi16(dst, inverse)));
+}
+
+AVX2_TARGET static void fillAvx2(uint32_t *dst, int count, uint32_t color)
+{
+   __m256i pixels = _mm256_set1_epi32((int)color);
+   int i = 0;
+   for (; i + 8 <= count; i += 8)
+      _mm256_storeu_si256((__m256i *)(dst + i), pixels);
+   fillScalar(dst + i, count - i, color);
+}
+
+AVX2_TARGET static void blendAvx2(uint32_t *dst, int count, uint32_t color)
+{
+   __m256i zero = _mm256_setzero_si256();
+   __m256i src = _mm256_unpacklo_epi8(_mm256_set1_epi32((int)color), zero);
+   __m256i alpha = _mm256_set1_epi16((short)(color >> 24));
+   int i = 0;
+   for (; i + 8 <= count; i += 8)
+   {
+      __m256i pixels = _mm256_loadu_si256((const __m256i *)(dst + i));
+      __m256i lo = blendAvx2(src, _mm256_unpacklo_epi8(pixels, zero), alpha);
+      __m256i hi = blendAvx2(src, _mm256_unpackhi_epi8(pixels, zero), alpha);
+      _mm256_storeu_si256((__m256i *)(dst + i), _mm256_packus_epi16(lo, hi));
+   }
+   blendScalar(dst + i, count - i, color);
+}
+
+AVX2_TARGET static void blendCoverageAvx2(uint32_t *dst, const unsigned char *coverage, int count, uint32_t color)
+{
+   __m256i zero = _mm256_setzero_si256();
+   __m256i src = _mm256_unpacklo_epi8(_mm256_set1_epi32((int)color), zero);
+   __m128i colorAlpha = _mm_set1_epi16((short)(color >> 24));
+   int i = 0;
+   for (; i + 8 <= count; i += 8)
+   {
+      long long bytes;
+      memcpy(&bytes, coverage + i, 8);
+      if (bytes == 0)
+         continue;
+      __m128i alpha16 = _mm_mullo_epi16(_mm_cvtepu8_epi16(_mm_cvtsi64_si128(bytes)), colorAlpha);
+      alpha16 = _mm_add_epi16(alpha16, _mm_set1_epi16(128));
+      alpha16 = _mm_srli_epi16(_mm_add_epi16(alpha16, _mm_srli_epi16(alpha16, 8)), 8);
+      // each 32-bit lane holds its pixel's alpha twice; unpacking pairs them to match the pixel unpacks
+      __m256i alpha = _mm256_cvtepu16_epi32(alpha16);
+      alpha = _mm256_or_si256(alpha, _mm256_slli_epi32(alpha, 16));
+
+      __m256i pixels = _mm256_loadu_si256((const __m256i *)(dst + i));
+      __m256i lo = blendAvx2(src, _mm256_unpacklo_epi8(pixels, zero), _mm256_unpacklo_epi32(alpha, alpha));
+      __m256i hi = blendAvx2(src, _mm256_unpackhi_epi8(pixels, zero), _mm256_unpackhi_epi32(alpha, alpha));
+      _mm256_storeu_si256((__m256i *)(dst + i), _mm256_packus_epi16(lo, hi));
+   }
+   blendCoverageScalar(dst + i, coverage + i, count - i, color);
+}
+
+#endif
+
+// -------- Dispatch --------
+
+static const RasterKernels kScalarKernels = {"scalar", fillScalar, blendScalar, blendCoverageScalar};
+#ifdef RASTER_X86
+static const RasterKernels kSse2Kernels = {"sse2", fillSse2, blendSse2, blendCoverageSse2};
+#endif
+#ifdef RASTER_AVX2
+static const RasterKernels kAvx2Kernels = {"avx2", fillAvx2, blendAvx2, blendCoverageAvx2};
+#endif
+
+static const RasterKernels *selectKernels()
+{
+   const char *forced = getenv("ENGINE_SIMD");
+   if (forced && strcmp(forced, "scalar") == 0)
+      return &kScalarKernels;
+
+#ifdef RASTER_AVX2
+   if ((!forced || strcmp(forced, "avx2") == 0) && __builtin_cpu_supports("avx2"))
+      return &kAvx2Kernels;
+#endif
+#ifdef RASTER_X86
+   return &kSse2Kernels;
+#else
+   return &kScalarKernels;
+#endif
+}
+
+const RasterKernels &rasterKernels()
+{
+   static const RasterKernels *kernels = selectKernels();
+   return *kernels;
+}
+
+const RasterKernels &rasterScalarKernels()
+{
+   return kScalarKernels;
+}
+
+// -------- Software renderer --------
+
+// Float color to RGBA8 the way GL converts to a unorm framebuffer
+static uint32_t packColor(float r, float g, float b, float a)
+{
+   auto unorm = [](float v)
+   {
+      return (uint32_t)std::lround(std::min(std::max(v, 0.0f), 1.0f) * 255.0f);
+   };
+   return unorm(r) | unorm(g) << 8 | unorm(b) << 16 | unorm(a) << 24;
+}
+
+SoftwareRenderer::SoftwareRenderer(int threadCount)
+    : kernels(rasterKernels())
+{
+   if (threadCount <= 0)
+      threadCount = (int)std::max(1u, std::thread::hardware_concurrency());
+   // the thread calling finish works through tiles too
+   for (int i = 1; i < threadCount; i++)
+      threads.emplace_back(&SoftwareRenderer::workerLoop, this);
+}
+
+SoftwareRenderer::~SoftwareRenderer()
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+   }
+   wake.notify_all();
+   for (std::thread &thread : threads)
+      thread.join();
+}
+
+void SoftwareRenderer::begin(int width, int height, float r, float g, float b)
+{
+   targetWidth = std::max(width, 0);
+   targetHeight = std::max(height, 0);
+   target.resize((size_t)targetWidth * targetHeight);
+   clearColor = packColor(r, g, b, 1.0f);
+   commands.clear();
+   masks.clear();
+   resetScissor();
+}
+
+// Top-left origin, like every other coordinate here
+void SoftwareRenderer::setScissor(int x, int y, int w, int h)
+{
+   scissor[0] = std::max(x, 0);
+   scissor[1] = std::max(y, 0);
+   scissor[2] = std::min(x + w, targetWidth);
+   scissor[3] = std::min(y + h, targetHeight);
+}
+
+void SoftwareRenderer::resetScissor()
+{
+   setScissor(0, 0, targetWidth, targetHeight);
+}
+
+void SoftwareRenderer::drawRectangle(float cx, float cy, float width, float height, float r, float g, float b, float a)
+{
+   // pixels whose centers fall inside, as the GL rasterizer decides
+   Command command = {};
+   command.x0 = std::max((int)std::ceil(cx - width / 2.0f - 0.5f), scissor[0]);
+   command.y0 = std::max((int)std::ceil(cy - height / 2.0f - 0.5f), scissor[1]);
+   command.x1 = std::min((int)std::ceil(cx + width / 2.0f - 0.5f), scissor[2]);
+   command.y1 = std::min((int)std::ceil(cy + height / 2.0f - 0.5f), scissor[3]);
+   command.color = packColor(r, g, b, a);
+   if (command.x0 < command.x1 && command.y0 < command.y1 && a > 0.0f)
+      commands.push_back(command);
+}
+
+// Signed distance to a box with a radius per corner, as the rect shader computes it; y grows downwards
+static float roundBox(float px, float py, float halfWidth, float halfHeight, const float *radii)
+{
+   float r = px < 0.0f ? (py < 0.0f ? radii[0] : radii[3]) : (py < 0.0f ? radii[1] : radii[2]);
+   float qx = std::abs(px) - halfWidth + r, qy = std::abs(py) - halfHeight + r;
+   return std::min(std::max(qx, qy), 0.0f) + std::hypot(std::max(qx, 0.0f), std::max(qy, 0.0f)) - r;
+}
+
+// The shader's approximation, so shadows fall off the same way
+static float erfApprox(float x)
+{
+   float s = x < 0.0f ? -1.0f : (x > 0.0f ? 1.0f : 0.0f), a = std::abs(x);
+   float t = 1.0f + (0.278393f + (0.230389f + 0.078108f * (a * a)) * a) * a;
+   t *= t;
+   return s - s / (t * t);
+}
+
+static float saturate(float v)
+{
+   return std::min(std::max(v, 0.0f), 1.0f);
+}
+
+template <typename Coverage>
+void SoftwareRenderer::drawMask(int x0, int y0, int x1, int y1, uint32_t color, Coverage coverage)
+{
+   Command command;
+   command.x0 = std::max(x0, scissor[0]);
+   command.y0 = std::max(y0, scissor[1]);
+   command.x1 = std::min(x1, scissor[2]);
+   command.y1 = std::min(y1, scissor[3]);
+   if (command.x0 >= command.x1 || command.y0 >= command.y1 || (color >> 24) == 0)
+      return;
+   command.color = color;
+   command.coverage = nullptr;
+   command.coverageX = command.x0;
+   command.coverageY = command.y0;
+   command.pitch = command.x1 - command.x0;
+   command.mask = masks.size();
+   masks.resize(masks.size() + (size_t)command.pitch * (command.y1 - command.y0));
+   unsigned char *out = masks.data() + command.mask;
+   for (int y = command.y0; y < command.y1; y++)
+      for (int x = command.x0; x < command.x1; x++)
+         *out++ = (unsigned char)std::lround(saturate(coverage(x + 0.5f, y + 0.5f)) * 255.0f);
+   commands.push_back(command);
+}
+
+void SoftwareRenderer::drawRect(float x, float y, float width, float height, const RectStyle &style)
+{
+   // clamped like RectBatch::add
+   float limit = std::min(width, height) / 2.0f;
+   float radii[4];
+   for (int i = 0; i < 4; i++)
+      radii[i] = std::min(style.radii[i], limit);
+   float borderWidth = std::min(style.borderWidth, limit);
+   float halfWidth = width / 2.0f, halfHeight = height / 2.0f;
+   float cx = x + halfWidth, cy = y + halfHeight;
+
+   if (style.shadow[3] > 0.0f)
+   {
+      ClipRect extent = rectExtent(x, y, width, height, style);
+      float scale = 1.0f / (std::max(style.shadowBlur * 0.5f, 0.25f) * 1.4142136f);
+      float ox = cx + style.shadowOffsetX, oy = cy + style.shadowOffsetY;
+      drawMask((int)std::floor(extent.x0), (int)std::floor(extent.y0), (int)std::ceil(extent.x1), (int)std::ceil(extent.y1),
+               packColor(style.shadow[0], style.shadow[1], style.shadow[2], style.shadow[3]), [&](float px, float py)
+               { return 0.5f - 0.5f * erfApprox(roundBox(px - ox, py - oy, halfWidth, halfHeight, radii) * scale); });
+   }
+
+   // the shape's ramp reaches half a pixel past its edge
+   int x0 = (int)std::floor(x - 1.0f), y0 = (int)std::floor(y - 1.0f);
+   int x1 = (int)std::ceil(x + width + 1.0f), y1 = (int)std::ceil(y + height + 1.0f);
+   if (borderWidth > 0.0f)
+      drawMask(x0, y0, x1, y1, packColor(style.border[0], style.border[1], style.border[2], style.border[3]),
+               [&](float px, float py)
+               { return 0.5f - roundBox(px - cx, py - cy, halfWidth, halfHeight, radii); });
+   // the fill covers the border's inner ramp, as the shader mixes the two
+   drawMask(x0, y0, x1, y1, packColor(style.fill[0], style.fill[1], style.fill[2], style.fill[3]),
+            [&](float px, float py)
+            {
+               float d = roundBox(px - cx, py - cy, halfWidth, halfHeight, radii);
+               float shape = saturate(0.5f - d);
+               return borderWidth > 0.0f ? shape * saturate(0.5f - (d + borderWidth)) : shape;
+            });
+}
+
+void SoftwareRenderer::drawText(GlyphCache &glyphs, const std::string &text, float x, float y, SDL_Color color,
+                                const std::vector<TokenSpan> *spans, SDL_Color (*spanColor)(TokenKind))
+{
+   placed.clear();
+   glyphs.layout(text, x, y, color, spans, spanColor, placed);
+   for (const PlacedGlyph &quad : placed)
+   {
+      const Glyph &glyph = *quad.glyph;
+      if (glyph.coverage.empty())
+         continue;
+      drawCoverage(glyph.coverage.data(), glyph.region.w, (int)std::lround(quad.x), (int)std::lround(quad.y),
+                   glyph.region.w, glyph.region.h, quad.color);
+   }
+}
+
+void SoftwareRenderer::drawCoverage(const unsigned char *coverage, int pitch, int x, int y, int w, int h, SDL_Color color)
+{
+   Command command;
+   command.coverageX = x;
+   command.coverageY = y;
+   command.pitch = pitch;
+   command.coverage = coverage;
+   command.x0 = std::max(x, scissor[0]);
+   command.y0 = std::max(y, scissor[1]);
+   command.x1 = std::min(x + w, scissor[2]);
+   command.y1 = std::min(y + h, scissor[3]);
+   command.color = color.r | color.g << 8 | color.b << 16 | (uint32_t)color.a << 24;
+   if (command.x0 < command.x1 && command.y0 < command.y1)
+      commands.push_back(command);
+}
+
+void SoftwareRenderer::rasterizeTile(int tile)
+{
+   int tilesAcross = (targetWidth + kTileSize - 1) / kTileSize;
+   int tx0 = (tile % tilesAcross) * kTileSize, ty0 = (tile / tilesAcross) * kTileSize;
+   int tx1 = std::min(tx0 + kTileSize, targetWidth), ty1 = std::min(ty0 + kTileSize, targetHeight);
+
+   for (int y = ty0; y < ty1; y++)
+      kernels.fill(&target[(size_t)y * targetWidth + tx0], tx1 - tx0, clearColor);
+
+   for (const Command &command : commands)
+   {
+      int x0 = std::max(command.x0, tx0), x1 = std::min(command.x1, tx1);
+      int y0 = std::max(command.y0, ty0), y1 = std::min(command.y1, ty1);
+      if (x0 >= x1 || y0 >= y1)
+         continue;
+
+      for (int y = y0; y < y1; y++)
+      {
+         uint32_t *dst = &target[(size_t)y * targetWidth + x0];
+         if (command.coverage)
+            kernels.blendCoverage(dst, command.coverage + (size_t)(y - command.coverageY) * command.pitch + (x0 - command.coverageX),
+                                  x1 - x0, command.color);
+         else if ((command.color >> 24) == 255)
+            kernels.fill(dst, x1 - x0, command.color);
+         else
+            kernels.blend(dst, x1 - x0, command.color);
+      }
+   }
+}
+
+void SoftwareRenderer::workerLoop()
+{
+   uint64_t seen = 0;
+   std::unique_lock<std::mutex> lock(mutex);
+   while (true)
+   {
+      wake.wait(lock, [&]
+                { return stopping || generation != seen; });
+      if (stopping)
+         return;
+      seen = generation;
+
+      while (nextTile < tileCount)
+      {
+         int tile = nextTile++;
+         lock.unlock();
+         rasterizeTile(tile);
+         lock.lock();
+      }
+      if (--busy == 0)
+         done.notify_one();
+   }
+}
+
+void SoftwareRenderer::finish()
+{
+   int tiles = ((targetWidth + kTileSize - 1) / kTileSize) * ((targetHeight + kTileSize - 1) / kTileSize);
+   if (tiles == 0)
+      return;
+
+   // masks are done growing; point their commands at them
+   for (Command &command : commands)
+      if (command.mask != kNoMask)
+         command.coverage = masks.data() + command.mask;
+
+   std::unique_lock<std::mutex> lock(mutex);
+   nextTile = 0;
+   tileCount = tiles;
+   busy = (int)threads.size();
+   generation++;
+   wake.notify_all();
+
+   while (nextTile < tileCount)
+   {
+      int tile = nextTile++;
+      lock.unlock();
+      rasterizeTile(tile);
+      lock.lock();
+   }
+   done.wait(lock, [this]
+             { return busy == 0; });
+}
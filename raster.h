@@ -0,0 +1,112 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include "glyphs.h"
+#include "rects.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Span kernels on RGBA8 pixels. Blending is GL_SRC_ALPHA / GL_ONE_MINUS_SRC_ALPHA
+// on all four channels with exact rounding, so every implementation produces
+// the same bytes. Picked like the UTF-8 kernels: AVX2, SSE2 or scalar, with
+// ENGINE_SIMD in the environment forcing one.
+struct RasterKernels
+{
+   const char *name;
+   void (*fill)(uint32_t *dst, int count, uint32_t color);
+   void (*blend)(uint32_t *dst, int count, uint32_t color);
+   // color alpha scaled by one coverage byte per pixel
+   void (*blendCoverage)(uint32_t *dst, const unsigned char *coverage, int count, uint32_t color);
+};
+
+const RasterKernels &rasterKernels();
+const RasterKernels &rasterScalarKernels();
+
+// CPU backend with the same draw calls as the GL path, for machines without a
+// GPU (thumbnails, screenshots). Draws are recorded, then finish() splits the
+// target into tiles and rasterizes them on worker threads; each tile walks the
+// commands in order, so the result doesn't depend on the thread count.
+// Pixels are RGBA8, top row first, like glReadPixels of a flipped framebuffer.
+// Blending is done on the stored values, like GL into a linear RGBA8 target;
+// the golden "software" scene holds the two within the perceptual tolerance.
+class SoftwareRenderer
+{
+public:
+   static constexpr int kTileSize = 64;
+
+   // threads = 0 uses every core
+   explicit SoftwareRenderer(int threads = 0);
+   ~SoftwareRenderer();
+   SoftwareRenderer(const SoftwareRenderer &) = delete;
+   SoftwareRenderer &operator=(const SoftwareRenderer &) = delete;
+
+   // Start a frame cleared to the color, resizing the target if needed
+   void begin(int width, int height, float r, float g, float b);
+   void setScissor(int x, int y, int w, int h);
+   void resetScissor();
+
+   // Center and size, like drawRectangle
+   void drawRectangle(float cx, float cy, float width, float height, float r, float g, float b, float a = 1.0f);
+   // Top-left and size in target pixels, evaluating the rect shader's distance
+   // field at pixel centers: the shadow, then the border and fill are blended
+   // through coverage masks, which is the shader's composite up to rounding
+   void drawRect(float x, float y, float width, float height, const RectStyle &style);
+   // Glyphs must come from a cache without an uploader, which keeps their coverage on the CPU
+   void drawText(GlyphCache &glyphs, const std::string &text, float x, float y, SDL_Color color,
+                 const std::vector<TokenSpan> *spans = nullptr, SDL_Color (*spanColor)(TokenKind) = nullptr);
+   // w x h bytes of coverage, pitch apart, tinted and blended with the top-left
+   // at x, y; the bytes have to stay alive until finish
+   void drawCoverage(const unsigned char *coverage, int pitch, int x, int y, int w, int h, SDL_Color color);
+   // Rasterize everything drawn since begin
+   void finish();
+
+   const unsigned char *pixels() const { return (const unsigned char *)target.data(); }
+   int width() const { return targetWidth; }
+   int height() const { return targetHeight; }
+
+private:
+   static constexpr size_t kNoMask = (size_t)-1;
+
+   struct Command
+   {
+      int x0, y0, x1, y1;              // clipped pixel bounds, exclusive end
+      uint32_t color;
+      const unsigned char *coverage;   // glyphs and masks only
+      int coverageX, coverageY, pitch; // target position of the coverage's first texel
+      size_t mask = kNoMask;           // offset into masks, resolved in finish
+   };
+
+   // Evaluates coverage over the bounds and queues it as a mask command
+   template <typename Coverage>
+   void drawMask(int x0, int y0, int x1, int y1, uint32_t color, Coverage coverage);
+
+   void rasterizeTile(int tile);
+   void workerLoop();
+
+   std::vector<uint32_t> target;
+   int targetWidth = 0;
+   int targetHeight = 0;
+   uint32_t clearColor = 0;
+   int scissor[4] = {0, 0, 0, 0};
+   std::vector<Command> commands;
+   std::vector<PlacedGlyph> placed;
+   std::vector<unsigned char> masks; // rect coverage of this frame, one block per command
+   const RasterKernels &kernels;
+
+   std::mutex mutex;
+   std::condition_variable wake;
+   std::condition_variable done;
+   std::vector<std::thread> threads;
+   uint64_t generation = 0;
+   int nextTile = 0;
+   int tileCount = 0;
+   int busy = 0;
+   bool stopping = false;
+};
+
+#endif
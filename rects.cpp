@@ -0,0 +1,198 @@
+#include "rects.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+// x, y, w, h | radii | fill | border width, shadow blur, shadow offset | border color | shadow color | clip
+static const int kInstanceFloats = 28;
+
+namespace
+{
+// The same fields with geometry in position steps and colors as RGBA8
+struct CompactRect
+{
+   int16_t rect[4];
+   int16_t radii[4];
+   int16_t params[4];
+   int16_t clip[4];
+   uint8_t fill[4];
+   uint8_t border[4];
+   uint8_t shadow[4];
+};
+}
+
+static size_t instanceSize(VertexFormat format)
+{
+   return format == VERTEX_COMPACT ? sizeof(CompactRect) : kInstanceFloats * sizeof(float);
+}
+static const float kUnclipped[4] = {-1e30f, -1e30f, 1e30f, 1e30f};
+
+ClipRect rectExtent(float x, float y, float w, float h, const RectStyle &style)
+{
+   ClipRect extent = {x, y, x + w, y + h};
+   if (style.shadow[3] > 0.0f)
+   {
+      float reach = style.shadowBlur * 1.5f;
+      extent.x0 = std::min(extent.x0, x + style.shadowOffsetX - reach);
+      extent.y0 = std::min(extent.y0, y + style.shadowOffsetY - reach);
+      extent.x1 = std::max(extent.x1, x + w + style.shadowOffsetX + reach);
+      extent.y1 = std::max(extent.y1, y + h + style.shadowOffsetY + reach);
+   }
+   extent.x0 -= 1.0f;
+   extent.y0 -= 1.0f;
+   extent.x1 += 1.0f;
+   extent.y1 += 1.0f;
+   return extent;
+}
+
+void RectBatch::init(VertexFormat vertexFormat)
+{
+   format = vertexFormat;
+   glGenVertexArrays(1, &vao);
+   glGenBuffers(1, &corners);
+   glGenBuffers(1, &instances);
+
+   glBindVertexArray(vao);
+   float quad[] = {0, 0, 1, 0, 0, 1, 1, 1};
+   glBindBuffer(GL_ARRAY_BUFFER, corners);
+   glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+   glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void *)0);
+   glEnableVertexAttribArray(0);
+
+   // seven vec4s per instance
+   glBindBuffer(GL_ARRAY_BUFFER, instances);
+   GLsizei stride = (GLsizei)instanceSize(format);
+   auto attribute = [stride](GLuint index, GLenum type, size_t offset)
+   {
+      glVertexAttribPointer(index, 4, type, type == GL_UNSIGNED_BYTE, stride, (void *)offset);
+      glVertexAttribDivisor(index, 1);
+      glEnableVertexAttribArray(index);
+   };
+   if (format == VERTEX_COMPACT)
+   {
+      // geometry is scaled back to window units by the shader, colors are normalized
+      attribute(1, GL_SHORT, offsetof(CompactRect, rect));
+      attribute(2, GL_SHORT, offsetof(CompactRect, radii));
+      attribute(3, GL_UNSIGNED_BYTE, offsetof(CompactRect, fill));
+      attribute(4, GL_SHORT, offsetof(CompactRect, params));
+      attribute(5, GL_UNSIGNED_BYTE, offsetof(CompactRect, border));
+      attribute(6, GL_UNSIGNED_BYTE, offsetof(CompactRect, shadow));
+      attribute(7, GL_SHORT, offsetof(CompactRect, clip));
+   }
+   else
+      for (int i = 0; i < 7; i++)
+         attribute(1 + i, GL_FLOAT, i * 4 * sizeof(float));
+   glBindVertexArray(0);
+}
+
+void RectBatch::release()
+{
+   glDeleteBuffers(1, &instances);
+   glDeleteBuffers(1, &corners);
+   glDeleteVertexArrays(1, &vao);
+   instances = corners = vao = 0;
+}
+
+void RectBatch::begin(GLuint shaderProgram, const float *projection, int drawableWidth)
+{
+   program = shaderProgram;
+   data.clear();
+   draws = 0;
+   culled = 0;
+
+   glUseProgram(program);
+   glUniformMatrix4fv(glGetUniformLocation(program, "uProjection"), 1, GL_FALSE, projection);
+   step = format == VERTEX_COMPACT ? positionStep(projection, drawableWidth) : 1.0f;
+   glUniform1f(glGetUniformLocation(program, "uPositionScale"), step);
+   glEnable(GL_BLEND);
+   glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+void RectBatch::add(float x, float y, float w, float h, float r, float g, float b, float a)
+{
+   float instance[kInstanceFloats] = {x, y, w, h, 0, 0, 0, 0, r, g, b, a};
+   push(instance, {x - 1.0f, y - 1.0f, x + w + 1.0f, y + h + 1.0f});
+}
+
+void RectBatch::add(float x, float y, float w, float h, const RectStyle &style)
+{
+   // radii can't overlap; clamp to half the shorter side
+   float limit = std::min(w, h) / 2.0f;
+   float instance[kInstanceFloats] = {
+       x, y, w, h,
+       std::min(style.radii[0], limit), std::min(style.radii[1], limit),
+       std::min(style.radii[2], limit), std::min(style.radii[3], limit),
+       style.fill[0], style.fill[1], style.fill[2], style.fill[3],
+       std::min(style.borderWidth, limit), style.shadowBlur, style.shadowOffsetX, style.shadowOffsetY,
+       style.border[0], style.border[1], style.border[2], style.border[3],
+       style.shadow[0], style.shadow[1], style.shadow[2], style.shadow[3]};
+   push(instance, rectExtent(x, y, w, h, style));
+}
+
+// Stamp the current clip on an instance and queue it unless nothing would show
+void RectBatch::push(float *instance, const ClipRect &extent)
+{
+   std::copy(kUnclipped, kUnclipped + 4, instance + 24);
+   if (clips && clips->active())
+   {
+      const ClipRect &clip = clips->current();
+      if (!clip.overlaps(extent.x0, extent.y0, extent.x1, extent.y1))
+      {
+         culled++;
+         return;
+      }
+      instance[24] = clip.x0;
+      instance[25] = clip.y0;
+      instance[26] = clip.x1;
+      instance[27] = clip.y1;
+   }
+   if (format == VERTEX_FLOAT)
+   {
+      const unsigned char *bytes = (const unsigned char *)instance;
+      data.insert(data.end(), bytes, bytes + kInstanceFloats * sizeof(float));
+      return;
+   }
+
+   // past the range of compact positions is far off screen; trim the rect to it
+   ClipRect limit = positionRange(step);
+   float x0 = std::max(instance[0], limit.x0), y0 = std::max(instance[1], limit.y0);
+   float x1 = std::min(instance[0] + instance[2], limit.x1), y1 = std::min(instance[1] + instance[3], limit.y1);
+   if (x0 >= x1 || y0 >= y1)
+   {
+      culled++;
+      return;
+   }
+   const float geometry[4] = {x0, y0, x1 - x0, y1 - y0};
+
+   CompactRect packed;
+   for (int i = 0; i < 4; i++)
+   {
+      packed.rect[i] = packPosition(geometry[i], step);
+      packed.radii[i] = packPosition(instance[4 + i], step);
+      packed.fill[i] = packUnorm8(instance[8 + i]);
+      packed.params[i] = packPosition(instance[12 + i], step);
+      packed.border[i] = packUnorm8(instance[16 + i]);
+      packed.shadow[i] = packUnorm8(instance[20 + i]);
+      packed.clip[i] = packPosition(instance[24 + i], step);
+   }
+   size_t offset = data.size();
+   data.resize(offset + sizeof(packed));
+   memcpy(data.data() + offset, &packed, sizeof(packed));
+}
+
+void RectBatch::flush()
+{
+   if (data.empty())
+      return;
+
+   glUseProgram(program);
+   glBindVertexArray(vao);
+   glBindBuffer(GL_ARRAY_BUFFER, instances);
+   // orphan the previous contents instead of waiting for the GPU to finish with them
+   glBufferData(GL_ARRAY_BUFFER, data.size(), data.data(), GL_STREAM_DRAW);
+   glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)(data.size() / instanceSize(format)));
+
+   data.clear();
+   draws++;
+}
@@ -0,0 +1,70 @@
+#ifndef RECTS_H
+#define RECTS_H
+
+#include "clip.h"
+#include "vertex.h"
+
+#include <glad/glad.h>
+#include <vector>
+
+// Colors are straight (not premultiplied) RGBA, 0..1
+struct RectStyle
+{
+   float fill[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+   float radii[4] = {0.0f, 0.0f, 0.0f, 0.0f}; // top-left, top-right, bottom-right, bottom-left
+   float borderWidth = 0.0f;                   // drawn inside the edge
+   float border[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+   float shadowBlur = 0.0f; // roughly twice the Gaussian's standard deviation, like CSS
+   float shadowOffsetX = 0.0f, shadowOffsetY = 0.0f;
+   float shadow[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+};
+
+// Everything the rect shader can touch for a rect: the rect itself, its shadow
+// out to three standard deviations and a pixel of antialiasing
+ClipRect rectExtent(float x, float y, float w, float h, const RectStyle &style);
+
+// Rectangles drawn as one instanced quad each. The rect shader evaluates a
+// rounded-box distance field per fragment, which gives antialiased corners,
+// an inner border and a blurred drop shadow without extra geometry or
+// textures; a plain rectangle is the same instance with everything zeroed.
+// Everything added between flushes goes out in one draw call, blended as
+// premultiplied alpha. Each instance carries the clip that was current when
+// it was added and the vertex shader shrinks its quad to it, so rects under
+// different clips still share the draw; rects whose visible extent (shadow
+// included) misses the clip are never queued. An instance is 28 floats, or
+// 44 bytes of 16-bit fixed-point geometry and RGBA8 colors when compact.
+class RectBatch
+{
+public:
+   void init(VertexFormat format = VERTEX_COMPACT);
+   void release();
+
+   // drawableWidth is the target's width in device pixels
+   void begin(GLuint program, const float *projection, int drawableWidth);
+   // Solid rectangle by its top-left corner
+   void add(float x, float y, float w, float h, float r, float g, float b, float a = 1.0f);
+   void add(float x, float y, float w, float h, const RectStyle &style);
+   void flush();
+
+   // nullptr turns clipping off
+   void setClipStack(const ClipStack *stack) { clips = stack; }
+
+   int drawCalls() const { return draws; }
+   int rejected() const { return culled; }
+
+private:
+   void push(float *instance, const ClipRect &extent);
+
+   GLuint vao = 0;
+   GLuint corners = 0;   // unit quad shared by every instance
+   GLuint instances = 0;
+   GLuint program = 0;
+   const ClipStack *clips = nullptr;
+   VertexFormat format = VERTEX_COMPACT;
+   float step = 1.0f; // window units per stored position unit
+   std::vector<unsigned char> data;
+   int draws = 0;
+   int culled = 0;
+};
+
+#endif
@@ -0,0 +1,307 @@
+#include "shape.h"
+
+#include "utf8.h"
+
+#include <algorithm>
+#include <iostream>
+
+#ifdef ENGINE_HARFBUZZ
+#include <hb-ft.h>
+#endif
+
+void decodeText(const std::string &text, size_t length, std::vector<uint32_t> &codepoints, std::vector<uint32_t> &offsets)
+{
+   length = std::min(length, text.size());
+   codepoints.resize(length);
+   offsets.resize(length);
+
+   if (utf8Validate(text.data(), length))
+   {
+      codepoints.resize(utf8Decode(text.data(), length, codepoints.data()));
+      size_t offset = 0;
+      for (size_t i = 0; i < codepoints.size(); i++)
+      {
+         offsets[i] = (uint32_t)offset;
+         unsigned char lead = (unsigned char)text[offset];
+         offset += lead < 0x80 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+      }
+   }
+   else
+   {
+      for (size_t i = 0; i < length; i++)
+      {
+         codepoints[i] = (unsigned char)text[i];
+         offsets[i] = (uint32_t)i;
+      }
+   }
+   offsets.resize(codepoints.size());
+}
+
+// -------- Shaper --------
+
+Shaper::~Shaper()
+{
+   close();
+}
+
+#ifdef ENGINE_HARFBUZZ
+
+bool Shaper::open(const char *fontPath, int pointSize)
+{
+   close();
+   if (FT_Init_FreeType(&library) != 0 || FT_New_Face(library, fontPath, 0, &face) != 0)
+   {
+      std::cerr << "Shaper could not load " << fontPath << std::endl;
+      close();
+      return false;
+   }
+   // same size as SDL_ttf gives the font: points at 72 dpi
+   FT_Set_Char_Size(face, 0, pointSize * 64, 0, 0);
+   font = hb_ft_font_create_referenced(face);
+   return true;
+}
+
+void Shaper::close()
+{
+   if (font)
+      hb_font_destroy(font);
+   if (face)
+      FT_Done_Face(face);
+   if (library)
+      FT_Done_FreeType(library);
+   font = nullptr;
+   face = nullptr;
+   library = nullptr;
+}
+
+std::shared_ptr<const ShapedRun> Shaper::shape(const std::string &text, const std::string &features, TextDirection direction)
+{
+   auto run = std::make_shared<ShapedRun>();
+   run->text = text;
+   run->width = 0.0f;
+   run->rightToLeft = false;
+   if (!font)
+      return run;
+
+   std::vector<hb_feature_t> parsed;
+   for (size_t start = 0; start < features.size();)
+   {
+      size_t end = features.find(',', start);
+      if (end == std::string::npos)
+         end = features.size();
+      hb_feature_t feature;
+      if (hb_feature_from_string(features.data() + start, (int)(end - start), &feature))
+         parsed.push_back(feature);
+      start = end + 1;
+   }
+
+   hb_buffer_t *buffer = hb_buffer_create();
+   hb_buffer_add_utf8(buffer, text.data(), (int)text.size(), 0, (int)text.size());
+   if (direction != TEXT_AUTO)
+      hb_buffer_set_direction(buffer, direction == TEXT_RIGHT_TO_LEFT ? HB_DIRECTION_RTL : HB_DIRECTION_LTR);
+   hb_buffer_guess_segment_properties(buffer);
+   hb_shape(font, buffer, parsed.data(), (unsigned int)parsed.size());
+
+   unsigned int count;
+   const hb_glyph_info_t *infos = hb_buffer_get_glyph_infos(buffer, &count);
+   const hb_glyph_position_t *positions = hb_buffer_get_glyph_positions(buffer, &count);
+   run->rightToLeft = hb_buffer_get_direction(buffer) == HB_DIRECTION_RTL;
+   run->glyphs.reserve(count);
+
+   // 26.6 fixed point; HarfBuzz y points up
+   float pen = 0.0f;
+   for (unsigned int i = 0; i < count; i++)
+   {
+      run->glyphs.push_back({infos[i].codepoint | kGlyphIndexBit, infos[i].cluster,
+                             pen + positions[i].x_offset / 64.0f, -positions[i].y_offset / 64.0f});
+      pen += positions[i].x_advance / 64.0f;
+   }
+   run->width = pen;
+   hb_buffer_destroy(buffer);
+   return run;
+}
+
+#else
+
+bool Shaper::open(const char *fontPath, int pointSize)
+{
+   close();
+   std::lock_guard<std::mutex> lock(mutex);
+   font = TTF_OpenFont(fontPath, pointSize);
+   if (!font)
+   {
+      std::cerr << "Shaper could not load " << fontPath << ": " << TTF_GetError() << std::endl;
+      return false;
+   }
+   return true;
+}
+
+void Shaper::close()
+{
+   std::lock_guard<std::mutex> lock(mutex);
+   if (font)
+      TTF_CloseFont(font);
+   font = nullptr;
+}
+
+// One glyph per codepoint, spaced by advance and kerning
+std::shared_ptr<const ShapedRun> Shaper::shape(const std::string &text, const std::string &, TextDirection)
+{
+   auto run = std::make_shared<ShapedRun>();
+   run->text = text;
+   run->width = 0.0f;
+   run->rightToLeft = false;
+
+   std::vector<uint32_t> codepoints, offsets;
+   decodeText(text, text.size(), codepoints, offsets);
+   run->glyphs.reserve(codepoints.size());
+
+   std::lock_guard<std::mutex> lock(mutex);
+   if (!font)
+      return run;
+   float pen = 0.0f;
+   for (size_t i = 0; i < codepoints.size(); i++)
+   {
+      if (i > 0)
+         pen += TTF_GetFontKerningSizeGlyphs32(font, codepoints[i - 1], codepoints[i]);
+      run->glyphs.push_back({codepoints[i], offsets[i], pen, 0.0f});
+      int advance = 0;
+      if (TTF_GlyphMetrics32(font, codepoints[i], nullptr, nullptr, nullptr, nullptr, &advance) == 0)
+         pen += advance;
+   }
+   run->width = pen;
+   return run;
+}
+
+#endif
+
+// -------- Shaped run cache --------
+
+ShapeCache::ShapeCache(Shaper &shaper, int workers)
+    : shaper(shaper)
+{
+   for (int i = 0; i < workers; i++)
+      threads.emplace_back(&ShapeCache::workerLoop, this);
+}
+
+ShapeCache::~ShapeCache()
+{
+   shutdown();
+}
+
+void ShapeCache::shutdown()
+{
+   {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      stopping = true;
+      queue.clear();
+   }
+   wake.notify_all();
+   for (std::thread &thread : threads)
+      thread.join();
+   threads.clear();
+}
+
+// FNV-1a over the text, mixed with the font, features and direction
+uint64_t ShapeCache::keyOf(const std::string &text, const std::string &features, TextDirection direction) const
+{
+   uint64_t hash = 1469598103934665603ull;
+   for (unsigned char c : text)
+      hash = (hash ^ c) * 1099511628211ull;
+   hash ^= std::hash<std::string>()(features) + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2);
+   hash ^= (uint64_t)(uintptr_t)&shaper * 31 + (uint64_t)direction;
+   return hash;
+}
+
+std::shared_ptr<const ShapedRun> ShapeCache::find(uint64_t key, const std::string &text, const std::string &features,
+                                                  TextDirection direction)
+{
+   Shard &shard = shards[key % kShards];
+   std::lock_guard<std::mutex> lock(shard.mutex);
+   auto found = shard.entries.find(key);
+   if (found == shard.entries.end())
+      return nullptr;
+   const Entry &entry = *found->second;
+   // a full comparison keeps hash collisions from returning the wrong run
+   if (entry.direction != direction || entry.features != features || entry.run->text != text)
+      return nullptr;
+   shard.recent.splice(shard.recent.begin(), shard.recent, found->second);
+   return entry.run;
+}
+
+void ShapeCache::insert(uint64_t key, const std::string &features, TextDirection direction, std::shared_ptr<const ShapedRun> run)
+{
+   Shard &shard = shards[key % kShards];
+   std::lock_guard<std::mutex> lock(shard.mutex);
+   auto found = shard.entries.find(key);
+   if (found != shard.entries.end())
+      shard.recent.erase(found->second);
+   shard.recent.push_front({key, features, direction, std::move(run)});
+   shard.entries[key] = shard.recent.begin();
+
+   while (shard.recent.size() > kRunsPerShard)
+   {
+      shard.entries.erase(shard.recent.back().key);
+      shard.recent.pop_back();
+   }
+}
+
+std::shared_ptr<const ShapedRun> ShapeCache::get(const std::string &text, const std::string &features, TextDirection direction)
+{
+   uint64_t key = keyOf(text, features, direction);
+   if (std::shared_ptr<const ShapedRun> run = find(key, text, features, direction))
+   {
+      hitCount++;
+      return run;
+   }
+   missCount++;
+   std::shared_ptr<const ShapedRun> run = shaper.shape(text, features, direction);
+   insert(key, features, direction, run);
+   return run;
+}
+
+void ShapeCache::prefetch(const std::string &text, const std::string &features, TextDirection direction)
+{
+   if (threads.empty() || text.empty())
+      return;
+   {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      // newest requests matter most; the oldest have likely scrolled away
+      if (queue.size() >= kMaxQueued)
+         queue.pop_front();
+      queue.push_back({text, features, direction});
+   }
+   wake.notify_one();
+}
+
+void ShapeCache::clear()
+{
+   for (Shard &shard : shards)
+   {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.entries.clear();
+      shard.recent.clear();
+   }
+}
+
+void ShapeCache::workerLoop()
+{
+   std::unique_lock<std::mutex> lock(queueMutex);
+   while (true)
+   {
+      wake.wait(lock, [this]
+                { return stopping || !queue.empty(); });
+      if (stopping)
+         return;
+
+      Job job = std::move(queue.front());
+      queue.pop_front();
+      lock.unlock();
+
+      uint64_t key = keyOf(job.text, job.features, job.direction);
+      if (!find(key, job.text, job.features, job.direction))
+         insert(key, job.features, job.direction, shaper.shape(job.text, job.features, job.direction));
+
+      lock.lock();
+   }
+}
@@ -0,0 +1,152 @@
+#ifndef SHAPE_H
+#define SHAPE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef ENGINE_HARFBUZZ
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include <hb.h>
+#else
+#include <SDL2/SDL_ttf.h>
+#endif
+
+// Glyph cache keys with this bit set are font glyph indices rather than codepoints
+constexpr uint32_t kGlyphIndexBit = 0x80000000u;
+
+struct ShapedGlyph
+{
+   uint32_t glyph;   // glyph cache key
+   uint32_t cluster; // byte offset of the text it came from
+   float x, y;       // pen position relative to the run origin
+};
+
+struct ShapedRun
+{
+   std::string text;
+   std::vector<ShapedGlyph> glyphs; // in visual order
+   float width;
+   bool rightToLeft;
+};
+
+enum TextDirection
+{
+   TEXT_AUTO,
+   TEXT_LEFT_TO_RIGHT,
+   TEXT_RIGHT_TO_LEFT
+};
+
+// Codepoints of the first length bytes with the byte offset each starts at;
+// text that isn't valid UTF-8 is read as Latin-1
+void decodeText(const std::string &text, size_t length, std::vector<uint32_t> &codepoints, std::vector<uint32_t> &offsets);
+
+// Turns text into positioned glyphs. Built with ENGINE_HARFBUZZ it runs
+// HarfBuzz over its own FreeType face (ligatures, marks, contextual forms,
+// per-run direction and script) and yields glyph indices; otherwise it maps
+// codepoints one to one and applies the font's kerning through SDL_ttf.
+// Safe to call from several threads.
+class Shaper
+{
+public:
+   Shaper() = default;
+   ~Shaper();
+   Shaper(const Shaper &) = delete;
+   Shaper &operator=(const Shaper &) = delete;
+
+   bool open(const char *fontPath, int pointSize);
+   void close();
+   bool isOpen() const { return font != nullptr; }
+
+   // features are HarfBuzz feature strings separated by commas, e.g. "liga=0,tnum"
+   std::shared_ptr<const ShapedRun> shape(const std::string &text, const std::string &features, TextDirection direction);
+
+private:
+#ifdef ENGINE_HARFBUZZ
+   FT_Library library = nullptr;
+   FT_Face face = nullptr;
+   hb_font_t *font = nullptr; // hb-ft serializes its own face access
+#else
+   TTF_Font *font = nullptr;
+   std::mutex mutex;          // SDL_ttf fonts aren't thread-safe
+#endif
+};
+
+// Shaped runs keyed by (text, font, features, direction), split over locked
+// shards so the render thread and the workers rarely contend. get() shapes
+// on the calling thread on a miss; prefetch() hands text that is about to
+// come into view to worker threads so the render thread finds it shaped.
+// Each shard keeps its kRunsPerShard most recently used runs.
+class ShapeCache
+{
+public:
+   static constexpr int kShards = 16;
+   static constexpr size_t kRunsPerShard = 512;
+   static constexpr size_t kMaxQueued = 4096;
+
+   explicit ShapeCache(Shaper &shaper, int workers = 2);
+   ~ShapeCache();
+   ShapeCache(const ShapeCache &) = delete;
+   ShapeCache &operator=(const ShapeCache &) = delete;
+
+   std::shared_ptr<const ShapedRun> get(const std::string &text, const std::string &features = "",
+                                        TextDirection direction = TEXT_AUTO);
+   void prefetch(const std::string &text, const std::string &features = "", TextDirection direction = TEXT_AUTO);
+   void clear();
+   // Stop the workers; prefetch does nothing afterwards
+   void shutdown();
+
+   uint64_t hits() const { return hitCount; }
+   uint64_t misses() const { return missCount; }
+
+private:
+   struct Entry
+   {
+      uint64_t key;
+      std::string features;
+      TextDirection direction;
+      std::shared_ptr<const ShapedRun> run;
+   };
+
+   struct Shard
+   {
+      std::mutex mutex;
+      std::list<Entry> recent; // most recently used first
+      std::unordered_map<uint64_t, std::list<Entry>::iterator> entries;
+   };
+
+   struct Job
+   {
+      std::string text;
+      std::string features;
+      TextDirection direction;
+   };
+
+   uint64_t keyOf(const std::string &text, const std::string &features, TextDirection direction) const;
+   std::shared_ptr<const ShapedRun> find(uint64_t key, const std::string &text, const std::string &features,
+                                         TextDirection direction);
+   void insert(uint64_t key, const std::string &features, TextDirection direction, std::shared_ptr<const ShapedRun> run);
+   void workerLoop();
+
+   Shaper &shaper;
+   Shard shards[kShards];
+   std::atomic<uint64_t> hitCount{0};
+   std::atomic<uint64_t> missCount{0};
+
+   std::mutex queueMutex;
+   std::condition_variable wake;
+   std::deque<Job> queue;
+   bool stopping = false;
+   std::vector<std::thread> threads;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#include "startup.h"
+
+#include <algorithm>
+#include <cstdio>
+
+StartupTimeline::StartupTimeline()
+    : origin(SDL_GetPerformanceCounter()), frequency(SDL_GetPerformanceFrequency() / 1000.0),
+      mainThread(std::this_thread::get_id())
+{
+}
+
+double StartupTimeline::now() const
+{
+   return (SDL_GetPerformanceCounter() - origin) / frequency;
+}
+
+void StartupTimeline::record(const char *phase, double start)
+{
+   double end = now();
+   std::lock_guard<std::mutex> lock(mutex);
+   phases.push_back({phase, start, end, std::this_thread::get_id() != mainThread});
+}
+
+void StartupTimeline::firstFrame()
+{
+   if (firstFrameMs >= 0.0)
+      return;
+   firstFrameMs = now();
+   print();
+}
+
+void StartupTimeline::print() const
+{
+   std::vector<Phase> sorted;
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      sorted = phases;
+   }
+   std::stable_sort(sorted.begin(), sorted.end(), [](const Phase &a, const Phase &b)
+                    { return a.start < b.start; });
+
+   printf("%9s %9s  %-6s  %s\n", "start ms", "ms", "thread", "startup phase");
+   for (const Phase &phase : sorted)
+      printf("%9.2f %9.2f  %-6s  %s\n", phase.start, phase.end - phase.start, phase.worker ? "worker" : "main", phase.name);
+   if (firstFrameMs >= 0.0)
+      printf("time to first frame: %.2f ms\n", firstFrameMs);
+}
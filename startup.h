@@ -0,0 +1,42 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <SDL2/SDL.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Startup timeline. Phases are recorded from any thread with their start and
+// end in milliseconds since the timeline was made, which main does first, so
+// the parallel parts of initialization show up as overlapping rows. The
+// timeline is printed when the first frame has been presented, together with
+// the time to first frame.
+class StartupTimeline
+{
+public:
+   StartupTimeline();
+
+   double now() const;
+   // A phase that began at start, a value from now(), and ends now
+   void record(const char *phase, double start);
+   // Call after every present; the first call ends the timeline and prints it
+   void firstFrame();
+   void print() const;
+
+private:
+   struct Phase
+   {
+      const char *name;
+      double start, end;
+      bool worker; // recorded off the main thread
+   };
+
+   Uint64 origin;
+   double frequency; // performance counter ticks per ms
+   std::thread::id mainThread;
+   mutable std::mutex mutex;
+   std::vector<Phase> phases;
+   double firstFrameMs = -1.0;
+};
+
+#endif
@@ -0,0 +1,239 @@
+#include "upload.h"
+
+#include <algorithm>
+#include <cstring>
+
+static size_t bytesPerPixel(GLenum format)
+{
+   return format == GL_RED ? 1 : 4;
+}
+
+void TextureUploader::init(size_t bufferBytes)
+{
+   bufferSize = bufferBytes;
+   for (Buffer &buffer : buffers)
+   {
+      glGenBuffers(1, &buffer.pbo);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, bufferSize, nullptr, GL_STREAM_DRAW);
+   }
+   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void TextureUploader::release()
+{
+   if (mapped)
+   {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[current].pbo);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      mapped = nullptr;
+   }
+   for (Buffer &buffer : buffers)
+   {
+      if (buffer.fence)
+         glDeleteSync(buffer.fence);
+      glDeleteBuffers(1, &buffer.pbo);
+      buffer = Buffer();
+   }
+   copies.clear();
+   deferred.clear();
+   outstanding.clear();
+}
+
+// Non-blocking fence check; retires the buffer's uploads once the GPU is done with it
+bool TextureUploader::bufferAvailable(Buffer &buffer)
+{
+   if (!buffer.fence)
+      return true;
+
+   GLenum status = glClientWaitSync(buffer.fence, 0, 0);
+   if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+      return false;
+
+   glDeleteSync(buffer.fence);
+   buffer.fence = nullptr;
+   for (uint64_t ticket : buffer.tickets)
+      outstanding.erase(ticket);
+   buffer.tickets.clear();
+   return true;
+}
+
+// Space in the current buffer, mapped without synchronization: the fence already told us the GPU is done with it
+unsigned char *TextureUploader::reserve(size_t bytes, size_t &offset)
+{
+   Buffer &buffer = buffers[current];
+   if (!bufferAvailable(buffer))
+      return nullptr;
+
+   size_t aligned = (used + 3) & ~(size_t)3;
+   if (aligned + bytes > bufferSize)
+      return nullptr;
+
+   if (!mapped)
+   {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+      mapped = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, aligned, bufferSize - aligned,
+                                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      if (!mapped)
+         return nullptr;
+      mappedBase = aligned;
+   }
+
+   offset = aligned;
+   used = aligned + bytes;
+   return mapped + (aligned - mappedBase);
+}
+
+void TextureUploader::stageRows(GLuint texture, int x, int y, int w, int rows, GLenum format,
+                                const unsigned char *pixels, size_t pitch, unsigned char *dst, size_t offset)
+{
+   size_t rowBytes = w * bytesPerPixel(format);
+   if (pitch == rowBytes)
+      memcpy(dst, pixels, rowBytes * rows);
+   else
+      for (int row = 0; row < rows; row++)
+         memcpy(dst + row * rowBytes, pixels + row * pitch, rowBytes);
+   copies.push_back({texture, x, y, w, rows, format, offset});
+}
+
+uint64_t TextureUploader::upload(GLuint texture, int x, int y, int w, int h, GLenum format,
+                                 const void *pixels, int pitch, bool urgent)
+{
+   uint64_t ticket = ++nextTicket;
+   if (w <= 0 || h <= 0)
+      return ticket;
+
+   const unsigned char *src = (const unsigned char *)pixels;
+   size_t rowBytes = w * bytesPerPixel(format);
+   size_t srcPitch = pitch ? (size_t)pitch : rowBytes;
+   size_t bytes = rowBytes * h;
+
+   bool withinBudget = urgent || frameBudget == 0 || bytesThisFrame + bytes <= frameBudget;
+   if (withinBudget && (urgent || deferred.empty()))
+   {
+      size_t offset;
+      unsigned char *dst = reserve(bytes, offset);
+      if (dst)
+      {
+         stageRows(texture, x, y, w, h, format, src, srcPitch, dst, offset);
+         buffers[current].tickets.push_back(ticket);
+         outstanding.insert(ticket);
+         bytesThisFrame += bytes;
+         return ticket;
+      }
+
+      if (urgent)
+      {
+         // ring full or still owned by the GPU: fall back to a client-memory upload,
+         // after anything already staged so that uploads land in order
+         flush();
+         glBindTexture(GL_TEXTURE_2D, texture);
+         glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+         glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)(srcPitch / bytesPerPixel(format)));
+         glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, format, GL_UNSIGNED_BYTE, pixels);
+         glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+         bytesThisFrame += bytes;
+         return ticket;
+      }
+   }
+
+   Deferred pending = {texture, x, y, w, h, format, 0, ticket, std::vector<unsigned char>(bytes)};
+   for (int row = 0; row < h; row++)
+      memcpy(pending.pixels.data() + row * rowBytes, src + row * srcPitch, rowBytes);
+   deferred.push_back(std::move(pending));
+   outstanding.insert(ticket);
+   return ticket;
+}
+
+// Stage as many rows of deferred uploads as the budget and the current buffer allow
+void TextureUploader::pumpDeferred()
+{
+   while (!deferred.empty())
+   {
+      Deferred &pending = deferred.front();
+      size_t rowBytes = pending.w * bytesPerPixel(pending.format);
+      size_t budgetLeft = frameBudget == 0 ? bufferSize : (frameBudget > bytesThisFrame ? frameBudget - bytesThisFrame : 0);
+      size_t aligned = (used + 3) & ~(size_t)3;
+      size_t space = bufferSize > aligned ? bufferSize - aligned : 0;
+      if (rowBytes > bufferSize)
+      {
+         // a single row that can never be staged goes straight from client memory
+         glBindTexture(GL_TEXTURE_2D, pending.texture);
+         glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+         glTexSubImage2D(GL_TEXTURE_2D, 0, pending.x, pending.y, pending.w, pending.h, pending.format,
+                         GL_UNSIGNED_BYTE, pending.pixels.data());
+         outstanding.erase(pending.ticket);
+         deferred.pop_front();
+         continue;
+      }
+      // a fresh frame always makes progress, even when one row exceeds the budget
+      if (bytesThisFrame == 0)
+         budgetLeft = std::max(budgetLeft, rowBytes);
+
+      size_t rows = std::min({(size_t)(pending.h - pending.rowsDone), budgetLeft / rowBytes, space / rowBytes});
+      if (rows == 0)
+         return;
+
+      size_t offset;
+      unsigned char *dst = reserve(rows * rowBytes, offset);
+      if (!dst)
+         return;
+      stageRows(pending.texture, pending.x, pending.y + pending.rowsDone, pending.w, (int)rows, pending.format,
+                pending.pixels.data() + pending.rowsDone * rowBytes, rowBytes, dst, offset);
+      bytesThisFrame += rows * rowBytes;
+      pending.rowsDone += (int)rows;
+
+      if (pending.rowsDone < pending.h)
+         return;
+      buffers[current].tickets.push_back(pending.ticket);
+      deferred.pop_front();
+   }
+}
+
+void TextureUploader::flush()
+{
+   pumpDeferred();
+   if (!mapped)
+      return;
+
+   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[current].pbo);
+   glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+   mapped = nullptr;
+
+   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+   for (const Copy &copy : copies)
+   {
+      glBindTexture(GL_TEXTURE_2D, copy.texture);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, copy.x, copy.y, copy.w, copy.h, copy.format, GL_UNSIGNED_BYTE,
+                      (void *)(uintptr_t)copy.offset);
+   }
+   copies.clear();
+   glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void TextureUploader::endFrame()
+{
+   flush();
+
+   if (used > 0)
+   {
+      buffers[current].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      current = (current + 1) % kBuffers;
+      used = 0;
+   }
+   bytesThisFrame = 0;
+
+   // retire finished buffers now rather than when the ring comes back around
+   for (Buffer &buffer : buffers)
+      bufferAvailable(buffer);
+}
+
+size_t TextureUploader::pendingBytes() const
+{
+   size_t bytes = 0;
+   for (const Deferred &pending : deferred)
+      bytes += (size_t)(pending.h - pending.rowsDone) * pending.w * bytesPerPixel(pending.format);
+   return bytes;
+}
@@ -0,0 +1,91 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <unordered_set>
+#include <vector>
+
+// Texture upload service. Pixels are copied into a ring of pixel unpack
+// buffers and glTexSubImage2D is issued from buffer offsets, so the driver
+// never copies from client memory or stalls on it. Each buffer is fenced when
+// its frame ends and is only written again once the fence has signalled.
+// Non-urgent uploads are limited by a per-frame byte budget and are spread
+// across frames a band of rows at a time.
+class TextureUploader
+{
+public:
+   static constexpr int kBuffers = 3;
+
+   void init(size_t bufferBytes = 4 * 1024 * 1024);
+   void release();
+
+   // 0 disables the budget
+   void setFrameBudget(size_t bytes) { frameBudget = bytes; }
+
+   // Queue w x h pixels of format (GL_RED or GL_RGBA) for texture at (x, y).
+   // Rows are pitch bytes apart (0 means tightly packed). Urgent uploads are
+   // issued at the next flush regardless of the budget; others may be split.
+   // Returns a ticket for isComplete.
+   uint64_t upload(GLuint texture, int x, int y, int w, int h, GLenum format,
+                   const void *pixels, int pitch = 0, bool urgent = true);
+   // Issue everything staged so far; call before drawing with the textures
+   void flush();
+   // Fence this frame's buffer and move on to the next one
+   void endFrame();
+
+   // The upload has been consumed by the GPU and its staging memory recycled
+   bool isComplete(uint64_t ticket) const { return ticket <= nextTicket && !outstanding.count(ticket); }
+   size_t pendingBytes() const;
+   size_t frameBytes() const { return bytesThisFrame; }
+
+private:
+   struct Buffer
+   {
+      GLuint pbo = 0;
+      GLsync fence = nullptr;
+      std::vector<uint64_t> tickets; // uploads whose last rows were staged here
+   };
+
+   struct Copy
+   {
+      GLuint texture;
+      int x, y, w, h;
+      GLenum format;
+      size_t offset;
+   };
+
+   struct Deferred
+   {
+      GLuint texture;
+      int x, y, w, h;
+      GLenum format;
+      int rowsDone;
+      uint64_t ticket;
+      std::vector<unsigned char> pixels;
+   };
+
+   bool bufferAvailable(Buffer &buffer);
+   unsigned char *reserve(size_t bytes, size_t &offset);
+   void stageRows(GLuint texture, int x, int y, int w, int rows, GLenum format,
+                  const unsigned char *pixels, size_t pitch, unsigned char *dst, size_t offset);
+   void pumpDeferred();
+
+   Buffer buffers[kBuffers];
+   int current = 0;
+   size_t bufferSize = 0;
+   size_t used = 0;
+   unsigned char *mapped = nullptr;
+   size_t mappedBase = 0;
+
+   std::vector<Copy> copies;
+   std::deque<Deferred> deferred;
+   size_t frameBudget = 0;
+   size_t bytesThisFrame = 0;
+   uint64_t nextTicket = 0;
+   std::unordered_set<uint64_t> outstanding;
+};
+
+#endif
@@ -0,0 +1,410 @@
+#include "utf8.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define UTF8_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(UTF8_X86) && defined(__GNUC__)
+#define UTF8_AVX2 1
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+// -------- Scalar --------
+
+// Decode one sequence; returns its length in bytes, or 0 if it is invalid
+static inline size_t decodeSequence(const unsigned char *s, size_t length, uint32_t &codepoint)
+{
+   unsigned char c = s[0];
+   if (c < 0x80)
+   {
+      codepoint = c;
+      return 1;
+   }
+   if (c < 0xC2)
+      return 0;
+   if (c < 0xE0)
+   {
+      if (length < 2 || (s[1] & 0xC0) != 0x80)
+         return 0;
+      codepoint = ((c & 0x1F) << 6) | (s[1] & 0x3F);
+      return 2;
+   }
+   if (c < 0xF0)
+   {
+      if (length < 3 || (s[1] & 0xC0) != 0x80 || (s[2] & 0xC0) != 0x80)
+         return 0;
+      codepoint = ((c & 0x0F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F);
+      if (codepoint < 0x800 || (codepoint >= 0xD800 && codepoint <= 0xDFFF))
+         return 0;
+      return 3;
+   }
+   if (c < 0xF5)
+   {
+      if (length < 4 || (s[1] & 0xC0) != 0x80 || (s[2] & 0xC0) != 0x80 || (s[3] & 0xC0) != 0x80)
+         return 0;
+      codepoint = ((c & 0x07) << 18) | ((s[1] & 0x3F) << 12) | ((s[2] & 0x3F) << 6) | (s[3] & 0x3F);
+      if (codepoint < 0x10000 || codepoint > 0x10FFFF)
+         return 0;
+      return 4;
+   }
+   return 0;
+}
+
+// Decode one sequence into out, substituting U+FFFD for an invalid byte; returns bytes consumed
+static inline size_t decodeOrReplace(const unsigned char *s, size_t length, uint32_t *out)
+{
+   size_t n = decodeSequence(s, length, *out);
+   if (n == 0)
+   {
+      *out = 0xFFFD;
+      return 1;
+   }
+   return n;
+}
+
+static size_t countNewlinesScalar(const char *data, size_t length)
+{
+   size_t count = 0;
+   for (size_t i = 0; i < length; i++)
+      count += data[i] == '\n';
+   return count;
+}
+
+static bool isAsciiScalar(const char *data, size_t length)
+{
+   for (size_t i = 0; i < length; i++)
+      if ((unsigned char)data[i] >= 0x80)
+         return false;
+   return true;
+}
+
+static bool validateScalar(const char *data, size_t length)
+{
+   const unsigned char *s = (const unsigned char *)data;
+   size_t i = 0;
+   uint32_t codepoint;
+   while (i < length)
+   {
+      size_t n = decodeSequence(s + i, length - i, codepoint);
+      if (n == 0)
+         return false;
+      i += n;
+   }
+   return true;
+}
+
+static size_t decodeScalar(const char *data, size_t length, uint32_t *out)
+{
+   const unsigned char *s = (const unsigned char *)data;
+   size_t i = 0, count = 0;
+   while (i < length)
+      i += decodeOrReplace(s + i, length - i, out + count++);
+   return count;
+}
+
+// -------- SSE2 --------
+
+#ifdef UTF8_X86
+
+static size_t countNewlinesSse2(const char *data, size_t length)
+{
+   const __m128i newline = _mm_set1_epi8('\n');
+   const __m128i zero = _mm_setzero_si128();
+   size_t count = 0, i = 0;
+
+   while (length - i >= 16)
+   {
+      // byte lanes count up to 255 matches before they are folded with a SAD
+      size_t blocks = std::min((length - i) / 16, (size_t)255);
+      __m128i acc = zero;
+      for (size_t b = 0; b < blocks; b++, i += 16)
+      {
+         __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+         acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, newline));
+      }
+      __m128i sums = _mm_sad_epu8(acc, zero);
+      count += (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_extract_epi16(sums, 4);
+   }
+   return count + countNewlinesScalar(data + i, length - i);
+}
+
+static bool isAsciiSse2(const char *data, size_t length)
+{
+   size_t i = 0;
+   for (; length - i >= 64; i += 64)
+   {
+      __m128i a = _mm_loadu_si128((const __m128i *)(data + i));
+      __m128i b = _mm_loadu_si128((const __m128i *)(data + i + 16));
+      __m128i c = _mm_loadu_si128((const __m128i *)(data + i + 32));
+      __m128i d = _mm_loadu_si128((const __m128i *)(data + i + 48));
+      if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d))))
+         return false;
+   }
+   for (; length - i >= 16; i += 16)
+      if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(data + i))))
+         return false;
+   return isAsciiScalar(data + i, length - i);
+}
+
+// SSE2 has no byte shuffle for the lookup-table validator, so ASCII blocks are
+// skipped sixteen at a time and multibyte sequences go through the scalar decoder
+static bool validateSse2(const char *data, size_t length)
+{
+   const unsigned char *s = (const unsigned char *)data;
+   size_t i = 0;
+   uint32_t codepoint;
+   while (i < length)
+   {
+      if (length - i >= 16 && !_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i))))
+      {
+         i += 16;
+         continue;
+      }
+      size_t n = decodeSequence(s + i, length - i, codepoint);
+      if (n == 0)
+         return false;
+      i += n;
+   }
+   return true;
+}
+
+static size_t decodeSse2(const char *data, size_t length, uint32_t *out)
+{
+   const unsigned char *s = (const unsigned char *)data;
+   const __m128i zero = _mm_setzero_si128();
+   size_t i = 0, count = 0;
+
+   while (i < length)
+   {
+      if (length - i >= 16)
+      {
+         __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+         int mask = _mm_movemask_epi8(v);
+         if (mask == 0)
+         {
+            // widen 16 ASCII bytes to 16 codepoints
+            __m128i lo = _mm_unpacklo_epi8(v, zero);
+            __m128i hi = _mm_unpackhi_epi8(v, zero);
+            _mm_storeu_si128((__m128i *)(out + count), _mm_unpacklo_epi16(lo, zero));
+            _mm_storeu_si128((__m128i *)(out + count + 4), _mm_unpackhi_epi16(lo, zero));
+            _mm_storeu_si128((__m128i *)(out + count + 8), _mm_unpacklo_epi16(hi, zero));
+            _mm_storeu_si128((__m128i *)(out + count + 12), _mm_unpackhi_epi16(hi, zero));
+            i += 16;
+            count += 16;
+            continue;
+         }
+         for (int ascii = __builtin_ctz(mask); ascii > 0; ascii--)
+            out[count++] = s[i++];
+      }
+      i += decodeOrReplace(s + i, length - i, out + count++);
+   }
+   return count;
+}
+
+#endif
+
+// -------- AVX2 --------
+
+#ifdef UTF8_AVX2
+
+AVX2_TARGET static size_t countNewlinesAvx2(const char *data, size_t length)
+{
+   const __m256i newline = _mm256_set1_epi8('\n');
+   const __m256i zero = _mm256_setzero_si256();
+   size_t count = 0, i = 0;
+
+   while (length - i >= 32)
+   {
+      size_t blocks = std::min((length - i) / 32, (size_t)255);
+      __m256i acc = zero;
+      for (size_t b = 0; b < blocks; b++, i += 32)
+      {
+         __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+         acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, newline));
+      }
+      __m256i sums = _mm256_sad_epu8(acc, zero);
+      count += (size_t)_mm256_extract_epi64(sums, 0) + (size_t)_mm256_extract_epi64(sums, 1) +
+               (size_t)_mm256_extract_epi64(sums, 2) + (size_t)_mm256_extract_epi64(sums, 3);
+   }
+   return count + countNewlinesScalar(data + i, length - i);
+}
+
+AVX2_TARGET static bool isAsciiAvx2(const char *data, size_t length)
+{
+   size_t i = 0;
+   for (; length - i >= 128; i += 128)
+   {
+      __m256i a = _mm256_loadu_si256((const __m256i *)(data + i));
+      __m256i b = _mm256_loadu_si256((const __m256i *)(data + i + 32));
+      __m256i c = _mm256_loadu_si256((const __m256i *)(data + i + 64));
+      __m256i d = _mm256_loadu_si256((const __m256i *)(data + i + 96));
+      if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d))))
+         return false;
+   }
+   for (; length - i >= 32; i += 32)
+      if (_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(data + i))))
+         return false;
+   return isAsciiScalar(data + i, length - i);
+}
+
+// Lookup-table validation (Keiser & Lemire): each byte pair is classified by
+// three nibble lookups whose AND is non-zero exactly when the pair is an error.
+static const uint8_t kByte1High[16] = {
+    0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, // ASCII followed by a continuation: too long
+    0x80, 0x80, 0x80, 0x80,                         // continuation: two continuations
+    0x21, 0x01, 0x15, 0x49};                        // leads: too short, overlong, surrogate, too large
+static const uint8_t kByte1Low[16] = {
+    0xE7, 0xA3, 0x83, 0x83, 0x8B, 0xCB, 0xCB, 0xCB,
+    0xCB, 0xCB, 0xCB, 0xCB, 0xCB, 0xDB, 0xCB, 0xCB};
+static const uint8_t kByte2High[16] = {
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0xE6, 0xAE, 0xBA, 0xBA,
+    0x01, 0x01, 0x01, 0x01};
+// A block ending with a lead byte that needs more bytes than remain is incomplete
+static const uint8_t kIncompleteMax[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xEF, 0xDF, 0xBF};
+
+AVX2_TARGET static inline __m256i lookupNibbles(const uint8_t *table, __m256i nibbles)
+{
+   __m256i lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)table));
+   return _mm256_shuffle_epi8(lut, nibbles);
+}
+
+// Bytes of input shifted N places later in the stream, pulling in the tail of previous
+template <int N>
+AVX2_TARGET static inline __m256i previousBytes(__m256i input, __m256i previous)
+{
+   return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(previous, input, 0x21), 16 - N);
+}
+
+AVX2_TARGET static inline __m256i blockErrors(__m256i input, __m256i previous)
+{
+   const __m256i lowNibble = _mm256_set1_epi8(0x0F);
+   __m256i prev1 = previousBytes<1>(input, previous);
+   __m256i byte1High = lookupNibbles(kByte1High, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), lowNibble));
+   __m256i byte1Low = lookupNibbles(kByte1Low, _mm256_and_si256(prev1, lowNibble));
+   __m256i byte2High = lookupNibbles(kByte2High, _mm256_and_si256(_mm256_srli_epi16(input, 4), lowNibble));
+   __m256i special = _mm256_and_si256(_mm256_and_si256(byte1High, byte1Low), byte2High);
+
+   // continuations owed to a 3- or 4-byte lead two or three bytes back
+   __m256i third = _mm256_subs_epu8(previousBytes<2>(input, previous), _mm256_set1_epi8(0xE0 - 0x80));
+   __m256i fourth = _mm256_subs_epu8(previousBytes<3>(input, previous), _mm256_set1_epi8((char)(0xF0 - 0x80)));
+   __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+   return _mm256_xor_si256(must23, special);
+}
+
+AVX2_TARGET static bool validateAvx2(const char *data, size_t length)
+{
+   const __m256i incompleteMax = _mm256_loadu_si256((const __m256i *)kIncompleteMax);
+   __m256i error = _mm256_setzero_si256();
+   __m256i previous = _mm256_setzero_si256();
+   __m256i incomplete = _mm256_setzero_si256();
+   size_t i = 0;
+
+   while (i < length)
+   {
+      __m256i input;
+      if (length - i >= 32)
+         input = _mm256_loadu_si256((const __m256i *)(data + i));
+      else
+      {
+         // zero padding is ASCII, so a truncated final sequence is still caught
+         alignas(32) char tail[32] = {};
+         memcpy(tail, data + i, length - i);
+         input = _mm256_load_si256((const __m256i *)tail);
+      }
+
+      if (_mm256_movemask_epi8(input) == 0)
+         error = _mm256_or_si256(error, incomplete);
+      else
+      {
+         error = _mm256_or_si256(error, blockErrors(input, previous));
+         incomplete = _mm256_subs_epu8(input, incompleteMax);
+      }
+      previous = input;
+      i += 32;
+
+      // bail out of long invalid inputs early
+      if ((i & 4095) == 0 && !_mm256_testz_si256(error, error))
+         return false;
+   }
+   error = _mm256_or_si256(error, incomplete);
+   return _mm256_testz_si256(error, error);
+}
+
+AVX2_TARGET static size_t decodeAvx2(const char *data, size_t length, uint32_t *out)
+{
+   const unsigned char *s = (const unsigned char *)data;
+   size_t i = 0, count = 0;
+
+   while (i < length)
+   {
+      if (length - i >= 32)
+      {
+         __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+         unsigned mask = (unsigned)_mm256_movemask_epi8(v);
+         if (mask == 0)
+         {
+            // widen 32 ASCII bytes to 32 codepoints, eight at a time
+            for (int k = 0; k < 32; k += 8)
+            {
+               __m128i bytes = _mm_loadl_epi64((const __m128i *)(s + i + k));
+               _mm256_storeu_si256((__m256i *)(out + count + k), _mm256_cvtepu8_epi32(bytes));
+            }
+            i += 32;
+            count += 32;
+            continue;
+         }
+         for (int ascii = __builtin_ctz(mask); ascii > 0; ascii--)
+            out[count++] = s[i++];
+      }
+      i += decodeOrReplace(s + i, length - i, out + count++);
+   }
+   return count;
+}
+
+#endif
+
+// -------- Dispatch --------
+
+static const Utf8Kernels kScalarKernels = {"scalar", countNewlinesScalar, isAsciiScalar, validateScalar, decodeScalar};
+#ifdef UTF8_X86
+static const Utf8Kernels kSse2Kernels = {"sse2", countNewlinesSse2, isAsciiSse2, validateSse2, decodeSse2};
+#endif
+#ifdef UTF8_AVX2
+static const Utf8Kernels kAvx2Kernels = {"avx2", countNewlinesAvx2, isAsciiAvx2, validateAvx2, decodeAvx2};
+#endif
+
+static const Utf8Kernels *selectKernels()
+{
+   const char *forced = getenv("ENGINE_SIMD");
+   if (forced && strcmp(forced, "scalar") == 0)
+      return &kScalarKernels;
+
+#ifdef UTF8_AVX2
+   if ((!forced || strcmp(forced, "avx2") == 0) && __builtin_cpu_supports("avx2"))
+      return &kAvx2Kernels;
+#endif
+#ifdef UTF8_X86
+   return &kSse2Kernels;
+#else
+   return &kScalarKernels;
+#endif
+}
+
+const Utf8Kernels &utf8Kernels()
+{
+   static const Utf8Kernels *kernels = selectKernels();
+   return *kernels;
+}
+
+const Utf8Kernels &utf8ScalarKernels()
+{
+   return kScalarKernels;
+}
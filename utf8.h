@@ -0,0 +1,43 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Text scanning kernels. The best implementation for the running CPU
+// (AVX2, SSE2 or scalar) is picked once at first use; ENGINE_SIMD=scalar,
+// sse2 or avx2 in the environment forces one, e.g. for benchmarking.
+struct Utf8Kernels
+{
+   const char *name;
+   size_t (*countNewlines)(const char *data, size_t length);
+   bool (*isAscii)(const char *data, size_t length);
+   bool (*validate)(const char *data, size_t length);
+   // Writes at most length codepoints to out, invalid bytes become U+FFFD; returns the count
+   size_t (*decode)(const char *data, size_t length, uint32_t *out);
+};
+
+const Utf8Kernels &utf8Kernels();
+const Utf8Kernels &utf8ScalarKernels();
+
+inline size_t utf8CountNewlines(const char *data, size_t length)
+{
+   return utf8Kernels().countNewlines(data, length);
+}
+
+inline bool utf8IsAscii(const char *data, size_t length)
+{
+   return utf8Kernels().isAscii(data, length);
+}
+
+inline bool utf8Validate(const char *data, size_t length)
+{
+   return utf8Kernels().validate(data, length);
+}
+
+inline size_t utf8Decode(const char *data, size_t length, uint32_t *out)
+{
+   return utf8Kernels().decode(data, length, out);
+}
+
+#endif
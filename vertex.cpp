@@ -0,0 +1,25 @@
+#include "vertex.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+VertexFormat vertexFormatFromEnvironment(VertexFormat fallback)
+{
+   const char *forced = getenv("ENGINE_VERTEX");
+   if (!forced)
+      return fallback;
+   if (strcmp(forced, "compact") == 0)
+      return VERTEX_COMPACT;
+   if (strcmp(forced, "float") == 0)
+      return VERTEX_FLOAT;
+   std::cerr << "Unknown ENGINE_VERTEX " << forced << ", using the default" << std::endl;
+   return fallback;
+}
+
+float positionStep(const float *projection, int drawableWidth)
+{
+   // projection[0] is 2 / width in window units
+   float scale = drawableWidth * projection[0] / 2.0f;
+   return 1.0f / (4.0f * (scale > 0.0f ? scale : 1.0f));
+}
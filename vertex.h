@@ -0,0 +1,49 @@
+#ifndef VERTEX_H
+#define VERTEX_H
+
+#include "clip.h"
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// How QuadBatch and RectBatch lay out what they stream to the GPU
+enum VertexFormat
+{
+   VERTEX_COMPACT, // 16-bit fixed-point positions, 16-bit normalized UVs, RGBA8 colors
+   VERTEX_FLOAT    // 32-bit floats throughout, as before
+};
+
+// ENGINE_VERTEX=compact or float forces one
+VertexFormat vertexFormatFromEnvironment(VertexFormat fallback);
+
+// Compact positions count quarter device pixels from the window's origin, so
+// glyphs snapped to device pixels stay exact at any scale and a short reaches
+// 8192 device pixels either way. Window units per count, from the target's
+// width in device pixels and an orthographic projection in window units.
+float positionStep(const float *projection, int drawableWidth);
+
+// What a compact position can hold, in window units
+inline ClipRect positionRange(float step)
+{
+   float reach = 32767.0f * step;
+   return {-reach, -reach, reach, reach};
+}
+
+inline int16_t packPosition(float value, float step)
+{
+   return (int16_t)std::lround(std::min(std::max(value / step, -32767.0f), 32767.0f));
+}
+
+inline uint16_t packUnorm16(float value)
+{
+   return (uint16_t)std::lround(std::min(std::max(value, 0.0f), 1.0f) * 65535.0f);
+}
+
+inline uint8_t packUnorm8(float value)
+{
+   return (uint8_t)std::lround(std::min(std::max(value, 0.0f), 1.0f) * 255.0f);
+}
+
+#endif
@@ -0,0 +1,97 @@
+#include "window.h"
+
+#include <algorithm>
+
+bool WindowState::pumping = false;
+bool WindowState::pumpSawEvent = false;
+Uint32 WindowState::firstEvent = 0;
+Uint32 WindowState::lastLiveRender = 0;
+
+void WindowState::beginPump()
+{
+   pumping = true;
+   pumpSawEvent = false;
+}
+
+void WindowState::endPump()
+{
+   pumping = false;
+}
+
+WindowState::~WindowState()
+{
+   detach();
+}
+
+void WindowState::attach(SDL_Window *target)
+{
+   detach();
+   window = target;
+   windowID = SDL_GetWindowID(window);
+   refresh();
+   SDL_AddEventWatch(watch, this);
+}
+
+void WindowState::detach()
+{
+   if (!window)
+      return;
+   SDL_DelEventWatch(watch, this);
+   window = nullptr;
+}
+
+void WindowState::refresh()
+{
+   SDL_GetWindowSize(window, &logicalWidth, &logicalHeight);
+   SDL_GL_GetDrawableSize(window, &pixelWidth, &pixelHeight);
+   float values[16] = {
+       2.0f / logicalWidth, 0, 0, 0,
+       0, -2.0f / logicalHeight, 0, 0,
+       0, 0, -1, 0,
+       -1, 1, 0, 1};
+   std::copy(values, values + 16, ortho);
+   SDL_DisplayMode mode;
+   if (SDL_GetWindowDisplayMode(window, &mode) == 0 && mode.refresh_rate > 0)
+      refreshMs = std::max(1000 / mode.refresh_rate, 1);
+   changes++;
+   needsDraw = true;
+}
+
+int SDLCALL WindowState::watch(void *userdata, SDL_Event *event)
+{
+   WindowState &state = *(WindowState *)userdata;
+   if (event->type != SDL_WINDOWEVENT || event->window.windowID != state.windowID)
+      return 0;
+
+   // A move to a display of another scale changes the drawable size under the same window size
+   if (event->window.event == SDL_WINDOWEVENT_SIZE_CHANGED || event->window.event == SDL_WINDOWEVENT_DISPLAY_CHANGED)
+      state.refresh();
+   else if (event->window.event == SDL_WINDOWEVENT_EXPOSED)
+      state.needsDraw = true;
+   else
+      return 0;
+
+   // an ordinary pump is done long before this; the main loop draws the latest size itself
+   if (state.liveResize && !state.rendering && state.liveRenderDue())
+   {
+      state.rendering = true;
+      state.liveResize();
+      state.rendering = false;
+      lastLiveRender = SDL_GetTicks();
+   }
+   return 0;
+}
+
+bool WindowState::liveRenderDue()
+{
+   if (!pumping)
+      return false;
+   Uint32 now = SDL_GetTicks();
+   if (!pumpSawEvent)
+   {
+      pumpSawEvent = true;
+      firstEvent = now;
+      return false;
+   }
+   return now - firstEvent >= refreshMs && now - lastLiveRender >= refreshMs;
+}
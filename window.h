@@ -0,0 +1,85 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include <SDL2/SDL.h>
+#include <cstdint>
+#include <functional>
+
+// Window size, drawable size and projection, kept current by an SDL event
+// watch instead of being queried every frame. The watch sees
+// SDL_WINDOWEVENT_SIZE_CHANGED the moment SDL does and only records the new
+// size and marks the window damaged; moving to a display with another scale
+// factor counts as a change too.
+//
+// Some platforms run a modal loop inside SDL_PumpEvents while the user drags
+// a window edge, so the main loop gets no chance to run until the drag ends.
+// The main loop brackets its pumping with beginPump()/endPump(). An ordinary
+// pump delivers a resize's events in one burst and returns; when one pump
+// keeps delivering them for longer than a refresh period, the main loop is
+// held, and the watch calls the live-resize callback set here, at most once
+// per refresh period, so the window keeps rendering during the drag.
+//
+// Every change bumps generation(); size-dependent state is rebuilt by
+// comparing it, at most once per frame and at the latest size however many
+// events a resize produced.
+//
+// It also tracks damage: a window needs drawing after attach, a size change
+// or an expose, or whenever the owner says so, and can otherwise be skipped.
+class WindowState
+{
+public:
+   WindowState() = default;
+   ~WindowState();
+   WindowState(const WindowState &) = delete;
+   WindowState &operator=(const WindowState &) = delete;
+
+   void attach(SDL_Window *window);
+   void detach();
+
+   int width() const { return logicalWidth; }
+   int height() const { return logicalHeight; }
+   int drawableWidth() const { return pixelWidth; }
+   int drawableHeight() const { return pixelHeight; }
+   // Drawable pixels per window unit
+   float scale() const { return logicalWidth ? (float)pixelWidth / logicalWidth : 1.0f; }
+   // Orthographic projection in window units, top-left origin
+   const float *projection() const { return ortho; }
+   uint64_t generation() const { return changes; }
+   Uint32 id() const { return windowID; }
+
+   bool damaged() const { return needsDraw; }
+   void damage() { needsDraw = true; }
+   void clearDamage() { needsDraw = false; }
+
+   // Called from the watch while a modal resize loop holds the main loop
+   void setLiveResize(std::function<void()> render) { liveResize = std::move(render); }
+
+   // Around every call that pumps SDL's events on the main loop
+   static void beginPump();
+   static void endPump();
+
+private:
+   static int SDLCALL watch(void *userdata, SDL_Event *event);
+   void refresh();
+   // Notes a window event seen by the current pump; true when the pump has
+   // been held past a refresh and no live render ran within one
+   bool liveRenderDue();
+
+   static bool pumping;
+   static bool pumpSawEvent;
+   static Uint32 firstEvent; // of the current pump
+   static Uint32 lastLiveRender;
+
+   SDL_Window *window = nullptr;
+   Uint32 windowID = 0;
+   int logicalWidth = 0, logicalHeight = 0;
+   int pixelWidth = 0, pixelHeight = 0;
+   float ortho[16] = {};
+   uint64_t changes = 0;
+   bool needsDraw = false;
+   Uint32 refreshMs = 16; // of the display the window is on
+   std::function<void()> liveResize;
+   bool rendering = false; // a render can itself trigger window events
+};
+
+#endif